@@ -28,4 +28,11 @@ typedef void (*battery_voltage_callback_t)(uint16_t voltage);
 void battery_init(battery_voltage_callback_t callback);
 void battery_sample_voltage();
 
+// Powers up the ADC, measures the battery voltage (mV) and powers it down
+// again. Implemented by the backend selected with BATTERY_BACKEND in the
+// board Makefile.
+// Blocking measurement, not reentrant. Once battery_load_init() has run it is
+// only used from the radio notification handler.
+uint16_t battery_measure_voltage();
+
 #endif // BATTERY_H
@@ -19,58 +19,42 @@
 // THE SOFTWARE.
 
 #include "battery.h"
+#include "battery_convert.h"
+#include "energy.h"
 
 #include "nrf_drv_adc.h"
 #include "app_error.h"
 
 #include "config.h"
 
-static nrf_adc_value_t m_battery_level_buffer[1];
-static battery_voltage_callback_t m_callback = NULL;
-
-#define DIODE_FWD_VOLT_DROP_MILLIVOLTS    270
-#define ADC_RES_10BIT                     1024
-#define ADC_REF_VBG_VOLTAGE_IN_MILLIVOLTS 1200
-#define ADC_INPUT_PRESCALER               3
-
-#define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE) ((((ADC_VALUE) * ADC_REF_VBG_VOLTAGE_IN_MILLIVOLTS) / ADC_RES_10BIT) * ADC_INPUT_PRESCALER)
-
 static void
 on_adc_event(nrf_drv_adc_evt_t const *event)
 {
-  if (event->type == NRF_DRV_ADC_EVT_DONE)
-    {
-      uint32_t err_code = nrf_drv_adc_buffer_convert(event->data.done.p_buffer, 1);
-      APP_ERROR_CHECK(err_code);
-
-      nrf_adc_value_t adc_result = event->data.done.p_buffer[0];
-      uint16_t battery_level_in_milli_volts = ADC_RESULT_IN_MILLI_VOLTS(adc_result) + DIODE_FWD_VOLT_DROP_MILLIVOLTS;
-
-      m_callback(battery_level_in_milli_volts);
-    }
+  // Only blocking conversions are used.
 }
 
-void
-battery_init(battery_voltage_callback_t callback)
+uint16_t
+battery_measure_voltage()
 {
-  m_callback = callback;
-
   uint32_t err_code = nrf_drv_adc_init(NULL, on_adc_event);
   APP_ERROR_CHECK(err_code);
 
-  static nrf_drv_adc_channel_t channel = NRF_DRV_ADC_DEFAULT_CHANNEL(NRF_ADC_CONFIG_INPUT_DISABLED);
+  nrf_drv_adc_channel_t channel = NRF_DRV_ADC_DEFAULT_CHANNEL(NRF_ADC_CONFIG_INPUT_DISABLED);
   channel.config.config.input = (uint32_t)NRF_ADC_CONFIG_SCALING_SUPPLY_ONE_THIRD;
-  nrf_drv_adc_channel_enable(&channel);
 
-  err_code = nrf_drv_adc_buffer_convert(&m_battery_level_buffer[0], 1);
-  APP_ERROR_CHECK(err_code);
-}
-
-void
-battery_sample_voltage()
-{
-  if (!nrf_drv_adc_is_busy())
+  // The legacy ADC has no hardware oversampling.
+  int32_t sum = 0;
+  for (int i = 0; i < BATTERY_SAMPLE_BURST; i++)
     {
-      nrf_drv_adc_sample();
+      nrf_adc_value_t value = 0;
+      err_code = nrf_drv_adc_sample_convert(&channel, &value);
+      APP_ERROR_CHECK(err_code);
+
+      sum += value;
     }
+
+  nrf_drv_adc_uninit();
+  energy_battery_measured();
+
+  return battery_adc_convert(sum / BATTERY_SAMPLE_BURST);
 }
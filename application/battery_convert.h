@@ -0,0 +1,67 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef BATTERY_CONVERT_H
+#define BATTERY_CONVERT_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Converts a raw ADC result to the battery voltage (mV). The ADC measures the
+// supply voltage divided by scaling against a reference voltage (mV) with a
+// full scale of 2^resolution.
+static inline uint16_t
+battery_convert(int32_t raw, uint32_t reference, uint32_t scaling, uint8_t resolution)
+{
+  if (raw < 0)
+    {
+      raw = 0;
+    }
+
+  uint32_t voltage = ((uint32_t) raw * reference * scaling + (1UL << (resolution - 1))) >> resolution;
+  return voltage + BATTERY_DIODE_DROP;
+}
+
+// SAADC: internal reference (mV) and the gain of 1/6 of the default channel
+// config.
+#define BATTERY_SAADC_REF_VOLTAGE_IN_MILLIVOLTS 600
+#define BATTERY_SAADC_PRE_SCALING_COMPENSATION  6
+#define BATTERY_SAADC_RESOLUTION_BITS           12
+
+static inline uint16_t
+battery_saadc_convert(int32_t raw)
+{
+  return battery_convert(raw, BATTERY_SAADC_REF_VOLTAGE_IN_MILLIVOLTS, BATTERY_SAADC_PRE_SCALING_COMPENSATION, BATTERY_SAADC_RESOLUTION_BITS);
+}
+
+// Legacy ADC: band gap reference (mV) and the 1/3 supply prescaler.
+#define BATTERY_ADC_REF_VBG_VOLTAGE_IN_MILLIVOLTS 1200
+#define BATTERY_ADC_INPUT_PRESCALER               3
+#define BATTERY_ADC_RESOLUTION_BITS               10
+
+static inline uint16_t
+battery_adc_convert(int32_t raw)
+{
+  return battery_convert(raw, BATTERY_ADC_REF_VBG_VOLTAGE_IN_MILLIVOLTS, BATTERY_ADC_INPUT_PRESCALER, BATTERY_ADC_RESOLUTION_BITS);
+}
+
+#endif // BATTERY_CONVERT_H
@@ -0,0 +1,85 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "battery_filter.h"
+
+#include "config.h"
+
+#define BATTERY_FILTER_FRACTION_BITS 4
+
+static uint16_t m_window[3];
+static uint8_t m_window_count = 0;
+static uint8_t m_window_next = 0;
+static uint32_t m_average = 0;
+static bool m_average_valid = false;
+
+static uint16_t
+median(uint16_t a, uint16_t b, uint16_t c)
+{
+  if (a > b)
+    {
+      uint16_t t = a;
+      a = b;
+      b = t;
+    }
+  if (b > c)
+    {
+      b = c;
+    }
+  return a > b ? a : b;
+}
+
+uint16_t
+battery_filter_update(uint16_t voltage)
+{
+  m_window[m_window_next] = voltage;
+  m_window_next = (m_window_next + 1) % 3;
+  if (m_window_count < 3)
+    {
+      m_window_count++;
+    }
+
+  uint16_t sample = voltage;
+  if (m_window_count == 3)
+    {
+      sample = median(m_window[0], m_window[1], m_window[2]);
+    }
+
+  uint32_t scaled = (uint32_t)sample << BATTERY_FILTER_FRACTION_BITS;
+  if (!m_average_valid)
+    {
+      m_average = scaled;
+      m_average_valid = true;
+    }
+  else if (scaled > m_average)
+    {
+      m_average += (scaled - m_average) >> BATTERY_FILTER_SHIFT;
+    }
+  else
+    {
+      m_average -= (m_average - scaled) >> BATTERY_FILTER_SHIFT;
+    }
+
+  return (m_average + (1 << (BATTERY_FILTER_FRACTION_BITS - 1))) >> BATTERY_FILTER_FRACTION_BITS;
+}
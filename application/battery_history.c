@@ -0,0 +1,447 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "battery_history.h"
+#include "battery_load.h"
+
+#include "config.h"
+#include "flash_record.h"
+#include "power.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "fds.h"
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+#include "nrf_soc.h"
+
+#define HISTORY_FILE     (0xF011)
+#define HISTORY_REC_KEY  (0x7011)
+// The day that is being filled. Replaced on every flush, so that flushes do
+// not take ring slots, and resumed on boot.
+#define HISTORY_PARTIAL_REC_KEY (0x7013)
+
+#define HISTORY_RECORD_WORDS ((sizeof(battery_history_record_t) + 3) / sizeof(uint32_t))
+
+typedef enum
+{
+  STREAM_STORED,
+  STREAM_CURRENT,
+  STREAM_END,
+  STREAM_DONE,
+} stream_state_t;
+
+APP_TIMER_DEF(m_history_timer_id);
+
+static battery_history_record_t m_record;
+static battery_history_record_t m_write_record;
+static battery_history_record_t m_partial_record;
+static uint16_t m_last_voltage = 0;
+static int8_t m_last_temperature = 0;
+static uint16_t m_minutes = 0;
+static flash_record_t m_flash_record =
+  {
+   .file_id = HISTORY_FILE,
+   .key     = HISTORY_REC_KEY,
+   .replace = false,
+  };
+static flash_record_t m_partial_flash_record =
+  {
+   .file_id = HISTORY_FILE,
+   .key     = HISTORY_PARTIAL_REC_KEY,
+   .replace = true,
+  };
+static volatile bool m_sample_due = false;
+static volatile bool m_sample_ready = false;
+static volatile uint16_t m_sample_voltage = 0;
+
+static stream_state_t m_stream_state = STREAM_DONE;
+static fds_find_token_t m_stream_token;
+static battery_history_record_t m_stream_record;
+static uint16_t m_stream_offset = sizeof(battery_history_record_t);
+
+static void
+record_reset(uint16_t sequence)
+{
+  memset(&m_record, 0, sizeof(m_record));
+  m_record.sequence = sequence;
+}
+
+static int8_t
+die_temperature()
+{
+  // The die temperature is reported in 0.25 degrees C.
+  int32_t temperature = 0;
+  if (sd_temp_get(&temperature) != NRF_SUCCESS)
+    {
+      return m_last_temperature;
+    }
+  temperature /= 4;
+  return MAX(INT8_MIN, MIN(INT8_MAX, temperature));
+}
+
+static void
+history_evict()
+{
+  fds_record_desc_t desc = {0};
+  fds_record_desc_t oldest_desc = {0};
+  fds_find_token_t tok = {0};
+  uint16_t oldest_age = 0;
+  int count = 0;
+
+  while (fds_record_find(HISTORY_FILE, HISTORY_REC_KEY, &desc, &tok) == FDS_SUCCESS)
+    {
+      fds_flash_record_t record = {0};
+      if (fds_record_open(&desc, &record) != FDS_SUCCESS)
+        {
+          continue;
+        }
+
+      const battery_history_record_t *stored = record.p_data;
+      uint16_t age = m_write_record.sequence - stored->sequence;
+      (void) fds_record_close(&desc);
+
+      count++;
+      if (age >= oldest_age)
+        {
+          oldest_age = age;
+          oldest_desc = desc;
+        }
+    }
+
+  if (count >= BATTERY_HISTORY_RECORDS)
+    {
+      ret_code_t rc = fds_record_delete(&oldest_desc);
+      if (rc != FDS_SUCCESS)
+        {
+          NRF_LOG_WARNING("Failed to delete battery history record (%d).", rc);
+        }
+    }
+}
+
+static void
+history_store()
+{
+  // With a critical battery the samples stay in RAM.
+  if (m_record.count == 0 || flash_record_busy(&m_flash_record) || !power_flash_allowed())
+    {
+      return;
+    }
+
+  m_write_record = m_record;
+  record_reset(m_record.sequence + 1);
+
+  history_evict();
+  flash_record_store(&m_flash_record, &m_write_record, HISTORY_RECORD_WORDS);
+}
+
+static void
+history_store_partial()
+{
+  if (m_record.count == 0 || flash_record_busy(&m_partial_flash_record) || !power_flash_allowed())
+    {
+      return;
+    }
+
+  m_partial_record = m_record;
+  flash_record_store(&m_partial_flash_record, &m_partial_record, HISTORY_RECORD_WORDS);
+}
+
+// Continues filling a partial day that was saved before a reset.
+static void
+history_resume(const battery_history_record_t *partial)
+{
+  m_record = *partial;
+
+  int32_t voltage = m_record.voltage;
+  int32_t temperature = m_record.temperature;
+  for (int index = 0; index < m_record.count - 1; index++)
+    {
+      uint8_t nibble = m_record.temperature_delta[index / 2] >> ((index % 2) * 4);
+      voltage += m_record.voltage_delta[index];
+      temperature += (int8_t) (nibble << 4) >> 4;
+    }
+  m_last_voltage = voltage;
+  m_last_temperature = temperature;
+
+  NRF_LOG_INFO("Resuming battery history record %d with %d samples.", m_record.sequence, m_record.count);
+}
+
+static void
+history_sample(uint16_t voltage)
+{
+  if (m_record.count == BATTERY_HISTORY_RECORD_SAMPLES)
+    {
+      // The previous record is still being written.
+      history_store();
+      if (m_record.count != 0)
+        {
+          return;
+        }
+    }
+
+  int8_t temperature = die_temperature();
+
+  if (m_record.count == 0)
+    {
+      m_record.voltage = voltage;
+      m_record.temperature = temperature;
+    }
+  else
+    {
+      int index = m_record.count - 1;
+      int32_t voltage_delta = MAX(INT8_MIN, MIN(INT8_MAX, (int32_t) voltage - m_last_voltage));
+      int32_t temperature_delta = MAX(-8, MIN(7, temperature - m_last_temperature));
+
+      m_record.voltage_delta[index] = voltage_delta;
+      if (index % 2 == 0)
+        {
+          m_record.temperature_delta[index / 2] |= temperature_delta & 0x0f;
+        }
+      else
+        {
+          m_record.temperature_delta[index / 2] |= (temperature_delta & 0x0f) << 4;
+        }
+
+      // Track the decoded values so that clamping does not accumulate.
+      voltage = m_last_voltage + voltage_delta;
+      temperature = m_last_temperature + temperature_delta;
+    }
+
+  m_last_voltage = voltage;
+  m_last_temperature = temperature;
+  m_record.count++;
+
+  if (m_record.count == BATTERY_HISTORY_RECORD_SAMPLES)
+    {
+      history_store();
+    }
+}
+
+// The voltage is taken from the next load measurement, so that the SAADC is
+// only used from the radio notification handler.
+static void
+history_request()
+{
+  m_sample_due = true;
+  battery_load_measure();
+}
+
+static void
+on_history_timer(void *context)
+{
+  if (m_sample_ready)
+    {
+      m_sample_ready = false;
+      history_sample(m_sample_voltage);
+    }
+
+  m_minutes++;
+  if (m_minutes >= BATTERY_HISTORY_INTERVAL)
+    {
+      m_minutes = 0;
+      history_request();
+    }
+}
+
+static void
+fds_evt_handler(fds_evt_t const *evt)
+{
+  flash_record_on_fds_evt(&m_flash_record, evt);
+  flash_record_on_fds_evt(&m_partial_flash_record, evt);
+}
+
+static bool
+battery_history_shutdown_handler(nrf_pwr_mgmt_evt_t event)
+{
+  battery_history_flush();
+
+  bool ready = flash_record_shutdown(&m_flash_record);
+  ready &= flash_record_shutdown(&m_partial_flash_record);
+  return ready;
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(battery_history_shutdown_handler, 0);
+
+static bool
+stream_next_record()
+{
+  switch (m_stream_state)
+    {
+    case STREAM_STORED:
+      {
+        fds_record_desc_t desc = {0};
+        while (fds_record_find(HISTORY_FILE, HISTORY_REC_KEY, &desc, &m_stream_token) == FDS_SUCCESS)
+          {
+            fds_flash_record_t record = {0};
+            if (fds_record_open(&desc, &record) != FDS_SUCCESS)
+              {
+                continue;
+              }
+
+            bool valid = record.p_header->length_words == HISTORY_RECORD_WORDS;
+            if (valid)
+              {
+                memcpy(&m_stream_record, record.p_data, sizeof(m_stream_record));
+              }
+            (void) fds_record_close(&desc);
+
+            if (valid)
+              {
+                return true;
+              }
+          }
+        m_stream_state = STREAM_CURRENT;
+      }
+      // fall through
+
+    case STREAM_CURRENT:
+      m_stream_state = STREAM_END;
+      if (m_record.count > 0)
+        {
+          m_stream_record = m_record;
+          return true;
+        }
+      // fall through
+
+    case STREAM_END:
+      m_stream_state = STREAM_DONE;
+      memset(&m_stream_record, 0, sizeof(m_stream_record));
+      return true;
+
+    default:
+      return false;
+    }
+}
+
+void
+battery_history_stream_start()
+{
+  memset(&m_stream_token, 0, sizeof(m_stream_token));
+  m_stream_state = STREAM_STORED;
+  m_stream_offset = sizeof(m_stream_record);
+}
+
+uint16_t
+battery_history_stream_read(uint8_t *buffer, uint16_t size)
+{
+  uint16_t len = 0;
+  while (len < size)
+    {
+      if (m_stream_offset == sizeof(m_stream_record))
+        {
+          if (!stream_next_record())
+            {
+              break;
+            }
+          m_stream_offset = 0;
+        }
+
+      uint16_t chunk = MIN(size - len, sizeof(m_stream_record) - m_stream_offset);
+      memcpy(buffer + len, (uint8_t *) &m_stream_record + m_stream_offset, chunk);
+      len += chunk;
+      m_stream_offset += chunk;
+    }
+  return len;
+}
+
+void
+battery_history_voltage_update(uint16_t voltage)
+{
+  if (m_sample_due)
+    {
+      m_sample_voltage = voltage;
+      m_sample_due = false;
+      m_sample_ready = true;
+    }
+}
+
+void
+battery_history_flush()
+{
+  if (m_record.count == BATTERY_HISTORY_RECORD_SAMPLES)
+    {
+      history_store();
+    }
+  history_store_partial();
+}
+
+void
+battery_history_init()
+{
+  (void) fds_register(fds_evt_handler);
+
+  // Continue the sequence after the newest stored record.
+  fds_record_desc_t desc = {0};
+  fds_find_token_t tok = {0};
+  bool found = false;
+  uint16_t newest = 0;
+
+  while (fds_record_find(HISTORY_FILE, HISTORY_REC_KEY, &desc, &tok) == FDS_SUCCESS)
+    {
+      fds_flash_record_t record = {0};
+      if (fds_record_open(&desc, &record) != FDS_SUCCESS)
+        {
+          continue;
+        }
+
+      const battery_history_record_t *stored = record.p_data;
+      if (!found || (int16_t) (stored->sequence - newest) > 0)
+        {
+          newest = stored->sequence;
+          found = true;
+        }
+      (void) fds_record_close(&desc);
+    }
+
+  record_reset(found ? newest + 1 : 0);
+
+  fds_find_token_t partial_tok = {0};
+  if (fds_record_find(HISTORY_FILE, HISTORY_PARTIAL_REC_KEY, &desc, &partial_tok) == FDS_SUCCESS)
+    {
+      fds_flash_record_t record = {0};
+      if (fds_record_open(&desc, &record) == FDS_SUCCESS)
+        {
+          // A partial day that was completed later is stale.
+          const battery_history_record_t *partial = record.p_data;
+          if (record.p_header->length_words == HISTORY_RECORD_WORDS &&
+              partial->count > 0 && partial->count <= BATTERY_HISTORY_RECORD_SAMPLES &&
+              (!found || partial->sequence == m_record.sequence))
+            {
+              history_resume(partial);
+            }
+          (void) fds_record_close(&desc);
+        }
+    }
+
+  ret_code_t err_code = app_timer_create(&m_history_timer_id, APP_TIMER_MODE_REPEATED, on_history_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_start(m_history_timer_id, APP_TIMER_TICKS(60 * 1000), NULL);
+  APP_ERROR_CHECK(err_code);
+
+  history_request();
+}
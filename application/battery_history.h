@@ -0,0 +1,57 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef BATTERY_HISTORY_H
+#define BATTERY_HISTORY_H
+
+#include <stdint.h>
+
+#define BATTERY_HISTORY_RECORD_SAMPLES 24
+
+// Hourly battery voltage and die temperature. A record holds up to a day of
+// samples: the first sample in full and every following sample as the
+// difference to its predecessor. Records are stored little endian in this
+// layout and are streamed as is.
+typedef struct
+{
+  uint16_t sequence;
+  uint16_t voltage;
+  int8_t temperature;
+  uint8_t count;
+  int8_t voltage_delta[BATTERY_HISTORY_RECORD_SAMPLES - 1];
+  // Signed 4-bit deltas, the first one in the low nibble.
+  uint8_t temperature_delta[BATTERY_HISTORY_RECORD_SAMPLES / 2];
+  uint8_t reserved;
+} battery_history_record_t;
+
+void battery_history_init();
+void battery_history_flush();
+
+// Rested voltage (mV) from a load measurement. The first one after a sample
+// was requested is logged on the next minute tick.
+void battery_history_voltage_update(uint16_t voltage);
+
+// A stream consists of the stored records, the record that is being filled
+// and a final record with a count of zero.
+void battery_history_stream_start();
+uint16_t battery_history_stream_read(uint8_t *buffer, uint16_t size);
+
+#endif // BATTERY_HISTORY_H
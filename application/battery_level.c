@@ -0,0 +1,126 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+
+#include "battery_level.h"
+
+#include "config.h"
+
+#include "app_util.h"
+#include "nrf_log.h"
+#include "nrf_soc.h"
+
+typedef struct
+{
+  uint16_t voltage;
+  uint8_t level;
+} battery_curve_point_t;
+
+// Rested voltage against remaining capacity at room temperature, from high to
+// low voltage. Between points the level is interpolated linearly.
+#if BATTERY_CHEMISTRY == BATTERY_CHEMISTRY_CR2032
+static const battery_curve_point_t m_curve[] =
+{
+  { 3000, 100 },
+  { 2950, 90 },
+  { 2900, 75 },
+  { 2850, 50 },
+  { 2800, 30 },
+  { 2700, 15 },
+  { 2600, 8 },
+  { 2500, 4 },
+  { 2300, 1 },
+  { 2000, 0 },
+};
+
+// Rise of the voltage drop (0.1 mV) per degree below the reference.
+#define BATTERY_TEMPERATURE_COEFFICIENT 20
+
+#elif BATTERY_CHEMISTRY == BATTERY_CHEMISTRY_CR2477
+static const battery_curve_point_t m_curve[] =
+{
+  { 3000, 100 },
+  { 2950, 85 },
+  { 2900, 65 },
+  { 2850, 45 },
+  { 2800, 25 },
+  { 2700, 10 },
+  { 2600, 5 },
+  { 2400, 1 },
+  { 2000, 0 },
+};
+
+#define BATTERY_TEMPERATURE_COEFFICIENT 12
+
+#else
+#error Unknown battery chemistry
+#endif
+
+// Temperature (degrees C) at which the curves were taken.
+#define BATTERY_REFERENCE_TEMPERATURE 25
+
+static int32_t
+temperature_compensation()
+{
+  // The die temperature is reported in 0.25 degrees C.
+  int32_t temperature = 0;
+  uint32_t err_code = sd_temp_get(&temperature);
+  if (err_code != NRF_SUCCESS)
+    {
+      return 0;
+    }
+  temperature /= 4;
+
+  if (temperature >= BATTERY_REFERENCE_TEMPERATURE)
+    {
+      return 0;
+    }
+
+  // A cold cell shows a lower voltage for the same remaining capacity.
+  int32_t compensation = ((BATTERY_REFERENCE_TEMPERATURE - temperature) * BATTERY_TEMPERATURE_COEFFICIENT) / 10;
+  NRF_LOG_DEBUG("Battery: %d C, compensating %d mV.", temperature, compensation);
+  return compensation;
+}
+
+uint8_t
+battery_level_percent(uint16_t voltage)
+{
+  int32_t compensated = voltage + temperature_compensation();
+
+  if (compensated >= m_curve[0].voltage)
+    {
+      return m_curve[0].level;
+    }
+
+  for (size_t i = 1; i < ARRAY_SIZE(m_curve); i++)
+    {
+      const battery_curve_point_t *high = &m_curve[i - 1];
+      const battery_curve_point_t *low = &m_curve[i];
+
+      if (compensated >= low->voltage)
+        {
+          return low->level + ((compensated - low->voltage) * (high->level - low->level)) / (high->voltage - low->voltage);
+        }
+    }
+
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+
+#include "battery.h"
+#include "battery_load.h"
+
+#include "config.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "ble_radio_notification.h"
+#include "nrf_log.h"
+#include "nrf_soc.h"
+
+typedef enum
+{
+  BATTERY_LOAD_IDLE,
+  BATTERY_LOAD_WAIT_RESTED,
+  BATTERY_LOAD_WAIT_LOADED,
+  BATTERY_LOAD_DONE,
+} battery_load_state_t;
+
+APP_TIMER_DEF(m_battery_load_timer_id);
+APP_TIMER_DEF(m_battery_result_timer_id);
+
+static battery_load_callback_t m_callback = NULL;
+static volatile battery_load_state_t m_state = BATTERY_LOAD_IDLE;
+static volatile uint16_t m_rested = 0;
+static volatile uint16_t m_loaded = 0;
+
+// ble_radio_notification tells active from inactive notifications by
+// toggling a flag on every interrupt. The interrupt therefore stays enabled;
+// notifications are ignored while no measurement is running. The interrupt
+// preempts the application timers, so it only samples; the result is handled
+// from a timer.
+static void
+on_radio_notification(bool radio_active)
+{
+  if (radio_active && m_state == BATTERY_LOAD_WAIT_RESTED)
+    {
+      // The radio has been idle since the previous event.
+      m_rested = battery_measure_voltage();
+      m_state = BATTERY_LOAD_WAIT_LOADED;
+    }
+  else if (!radio_active && m_state == BATTERY_LOAD_WAIT_LOADED)
+    {
+      // The cell has not yet recovered from the radio event.
+      m_loaded = battery_measure_voltage();
+      m_state = BATTERY_LOAD_DONE;
+
+      ret_code_t err_code = app_timer_start(m_battery_result_timer_id, APP_TIMER_MIN_TIMEOUT_TICKS, NULL);
+      APP_ERROR_CHECK(err_code);
+    }
+}
+
+static void
+on_battery_result_timer(void *context)
+{
+  uint16_t rested = m_rested;
+  uint16_t loaded = m_loaded;
+  m_state = BATTERY_LOAD_IDLE;
+
+  uint16_t resistance = 0;
+  if (rested > loaded)
+    {
+      resistance = ((uint32_t)(rested - loaded) * 1000) / BATTERY_RADIO_CURRENT;
+    }
+
+  NRF_LOG_INFO("Battery: %d mV rested, %d mV loaded, %d Ohm.", rested, loaded, resistance);
+  m_callback(rested, loaded, resistance);
+}
+
+static void
+on_battery_load_timer(void *context)
+{
+  battery_load_measure();
+}
+
+void
+battery_load_measure()
+{
+  if (m_state == BATTERY_LOAD_IDLE)
+    {
+      m_state = BATTERY_LOAD_WAIT_RESTED;
+    }
+}
+
+void
+battery_load_init(battery_load_callback_t callback)
+{
+  m_callback = callback;
+
+  ret_code_t err_code = ble_radio_notification_init(APP_IRQ_PRIORITY_LOW, BATTERY_RADIO_NOTIFICATION_DISTANCE, on_radio_notification);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_battery_load_timer_id, APP_TIMER_MODE_REPEATED, on_battery_load_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_battery_result_timer_id, APP_TIMER_MODE_SINGLE_SHOT, on_battery_result_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_start(m_battery_load_timer_id, APP_TIMER_TICKS(BATTERY_LOAD_INTERVAL), NULL);
+  APP_ERROR_CHECK(err_code);
+
+  battery_load_measure();
+}
@@ -19,63 +19,55 @@
 // THE SOFTWARE.
 
 #include "battery.h"
+#include "battery_convert.h"
+#include "energy.h"
 
 #include "nrf_drv_saadc.h"
+#include "app_error.h"
+#include "app_timer.h"
+#include "nrf_log.h"
 
 #include "config.h"
 
-static nrf_saadc_value_t m_battery_level_buffer[2];
-static battery_voltage_callback_t m_callback = NULL;
-
-#define ADC_REF_VOLTAGE_IN_MILLIVOLTS         600
-#define ADC_RES_10BIT                         1024
-#define ADC_PRE_SCALING_COMPENSATION          6
-#define DIODE_FWD_VOLT_DROP_MILLIVOLTS        270
-#define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE)  ((((ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS) / ADC_RES_10BIT) * ADC_PRE_SCALING_COMPENSATION)
+#define TICKS_TO_US(ticks) ((uint32_t) (((uint64_t) (ticks) * 1000000) / APP_TIMER_CLOCK_FREQ))
 
 static void
 on_saadc_event(nrf_drv_saadc_evt_t const *event)
 {
-  if (event->type == NRF_DRV_SAADC_EVT_DONE)
-    {
-      ret_code_t err_code = nrf_drv_saadc_buffer_convert(event->data.done.p_buffer, 1);
-      APP_ERROR_CHECK(err_code);
-
-      nrf_saadc_value_t adc_result = event->data.done.p_buffer[0];
-      uint16_t battery_level_in_milli_volts = ADC_RESULT_IN_MILLI_VOLTS(adc_result) + DIODE_FWD_VOLT_DROP_MILLIVOLTS;
-
-      m_callback(battery_level_in_milli_volts);
-    }
+  // Only blocking conversions are used.
 }
 
-void
-battery_init(battery_voltage_callback_t callback)
+uint16_t
+battery_measure_voltage()
 {
-  m_callback = callback;
+  uint32_t started = app_timer_cnt_get();
+
+  nrf_drv_saadc_config_t saadc_config = NRF_DRV_SAADC_DEFAULT_CONFIG;
+  saadc_config.resolution = NRF_SAADC_RESOLUTION_12BIT;
+  saadc_config.oversample = BATTERY_SAADC_OVERSAMPLE;
 
-  uint32_t err_code = nrf_drv_saadc_init(NULL, on_saadc_event);
+  // The SAADC is only powered while measuring. Leaving it initialised between
+  // samples keeps its bias current running during sleep.
+  ret_code_t err_code = nrf_drv_saadc_init(&saadc_config, on_saadc_event);
   APP_ERROR_CHECK(err_code);
 
+  // In burst mode a single sample task runs all oversampling conversions and
+  // yields their average.
   nrf_saadc_channel_config_t config = NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(NRF_SAADC_INPUT_VDD);
+  config.burst = NRF_SAADC_BURST_ENABLED;
   err_code = nrf_drv_saadc_channel_init(0, &config);
   APP_ERROR_CHECK(err_code);
 
-  err_code = nrf_drv_saadc_buffer_convert(&m_battery_level_buffer[0], 1);
+  nrf_saadc_value_t value = 0;
+  err_code = nrf_drv_saadc_sample_convert(0, &value);
   APP_ERROR_CHECK(err_code);
 
-  err_code = nrf_drv_saadc_buffer_convert(&m_battery_level_buffer[1], 1);
-  APP_ERROR_CHECK(err_code);
+  nrf_drv_saadc_uninit();
+  energy_battery_measured();
 
-  err_code = nrf_drv_saadc_sample();
-  APP_ERROR_CHECK(err_code);
-}
+  uint16_t voltage = battery_saadc_convert(value);
 
-void
-battery_sample_voltage()
-{
-  if (!nrf_drv_saadc_is_busy())
-    {
-      ret_code_t err_code = nrf_drv_saadc_sample();
-      APP_ERROR_CHECK(err_code);
-    }
+  NRF_LOG_DEBUG("Battery: %d mV, SAADC on for %d us.", voltage,
+                TICKS_TO_US(app_timer_cnt_diff_compute(app_timer_cnt_get(), started)));
+  return voltage;
 }
@@ -22,26 +22,86 @@
 #include <string.h>
 
 #include "battery.h"
+#include "battery_filter.h"
+#include "battery_history.h"
+#include "battery_level.h"
+#include "battery_load.h"
 #include "battery_service.h"
+#include "energy.h"
+#include "power.h"
 
 #include "config.h"
 
 #include "app_timer.h"
 #include "ble_bas.h"
+#include "ble_conn_state.h"
+#include "ble_srv_common.h"
+#include "nrf_sdh_ble.h"
+#include "peer_manager.h"
 
 APP_TIMER_DEF(m_battery_timer_id);
 BLE_BAS_DEF(m_bas);
 
+// Links that enabled battery level notifications.
+static bool m_notifying[NRF_SDH_BLE_TOTAL_LINK_COUNT];
+static bool m_battery_timer_running = false;
+
+// Last reported level and the filtered voltage it was derived from.
+static uint8_t m_level = 0;
+static uint16_t m_level_voltage = 0;
+static bool m_level_valid = false;
+
+static void
+battery_timer_update()
+{
+  bool needed = false;
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      needed |= m_notifying[i];
+    }
+
+  uint32_t err_code = NRF_SUCCESS;
+  if (needed && !m_battery_timer_running)
+    {
+      err_code = app_timer_start(m_battery_timer_id, APP_TIMER_TICKS(BATTERY_SERVICE_INTERVAL), NULL);
+    }
+  else if (!needed && m_battery_timer_running)
+    {
+      err_code = app_timer_stop(m_battery_timer_id);
+    }
+  APP_ERROR_CHECK(err_code);
+
+  m_battery_timer_running = needed;
+}
+
 static void
 on_battery_service_timer(void *context)
 {
-  battery_sample_voltage();
+  battery_load_measure();
 }
 
 static void
 on_battery_voltage(uint16_t voltage)
 {
-  int battery_percentage = battery_level_in_percent(voltage);
+  uint16_t filtered = battery_filter_update(voltage);
+  power_battery_update(filtered);
+
+  uint8_t battery_percentage = battery_level_percent(filtered);
+  energy_level_update(battery_percentage);
+
+  if (m_level_valid)
+    {
+      uint16_t delta = filtered > m_level_voltage ? filtered - m_level_voltage : m_level_voltage - filtered;
+      if (battery_percentage == m_level || delta <= BATTERY_HYSTERESIS)
+        {
+          return;
+        }
+    }
+
+  m_level = battery_percentage;
+  m_level_voltage = filtered;
+  m_level_valid = true;
+
   uint32_t err_code = ble_bas_battery_level_update(&m_bas, battery_percentage, BLE_CONN_HANDLE_ALL);
   if ((err_code != NRF_SUCCESS) &&
       (err_code != NRF_ERROR_INVALID_STATE) &&
@@ -53,24 +113,95 @@ on_battery_voltage(uint16_t voltage)
     }
 }
 
+static void
+on_battery_load(uint16_t rested, uint16_t loaded, uint16_t resistance)
+{
+  battery_history_voltage_update(rested);
+  on_battery_voltage(rested);
+}
+
+static void
+notifying_set(uint16_t conn_handle, bool notifying)
+{
+  uint16_t conn_idx = ble_conn_state_conn_idx(conn_handle);
+  if (conn_idx >= NRF_SDH_BLE_TOTAL_LINK_COUNT)
+    {
+      return;
+    }
+
+  bool subscribed = notifying && !m_notifying[conn_idx];
+  m_notifying[conn_idx] = notifying;
+  battery_timer_update();
+
+  if (subscribed)
+    {
+      // Give a new subscriber a fresh level instead of waiting an interval.
+      battery_load_measure();
+    }
+}
+
 static void
 on_bas_evt(ble_bas_t *bas, ble_bas_evt_t *evt)
 {
-  uint32_t err_code;
   switch (evt->evt_type)
     {
     case BLE_BAS_EVT_NOTIFICATION_ENABLED:
-      err_code = app_timer_start(m_battery_timer_id, APP_TIMER_TICKS(5000), NULL);
-      APP_ERROR_CHECK(err_code);
+      notifying_set(evt->conn_handle, true);
       break;
 
     case BLE_BAS_EVT_NOTIFICATION_DISABLED:
-      err_code = app_timer_stop(m_battery_timer_id);
-      APP_ERROR_CHECK(err_code);
+      notifying_set(evt->conn_handle, false);
+      break;
+    }
+}
+
+static void
+cccd_evaluate(uint16_t conn_handle)
+{
+  // Bonded peers get their CCCD restored without a write.
+  uint8_t cccd[BLE_CCCD_VALUE_LEN];
+  ble_gatts_value_t value;
+  memset(&value, 0, sizeof(value));
+  value.len = sizeof(cccd);
+  value.p_value = cccd;
+
+  uint32_t err_code = sd_ble_gatts_value_get(conn_handle, m_bas.battery_level_handles.cccd_handle, &value);
+  if (err_code == NRF_SUCCESS && value.len == sizeof(cccd))
+    {
+      notifying_set(conn_handle, ble_srv_is_notification_enabled(cccd));
+    }
+}
+
+static void
+on_ble_event(ble_evt_t const *ble_evt, void *context)
+{
+  switch (ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_DISCONNECTED:
+      // Clients rarely disable notifications before disconnecting.
+      notifying_set(ble_evt->evt.gap_evt.conn_handle, false);
+      break;
+
+    case BLE_GAP_EVT_CONN_SEC_UPDATE:
+      cccd_evaluate(ble_evt->evt.gap_evt.conn_handle);
+      break;
+
+    default:
       break;
     }
 }
 
+static void
+on_pm_evt(pm_evt_t const *pm_evt)
+{
+  // The peer manager restores the CCCD of a bonded peer when it connects,
+  // also if the peer does not encrypt the link again.
+  if (pm_evt->evt_id == PM_EVT_LOCAL_DB_CACHE_APPLIED)
+    {
+      cccd_evaluate(pm_evt->conn_handle);
+    }
+}
+
 void
 battery_service_init()
 {
@@ -93,4 +224,11 @@ battery_service_init()
   APP_ERROR_CHECK(err_code);
 
   battery_init(on_battery_voltage);
+  battery_load_init(on_battery_load);
+  battery_history_init();
+
+  err_code = pm_register(on_pm_evt);
+  APP_ERROR_CHECK(err_code);
+
+  NRF_SDH_BLE_OBSERVER(m_ble_observer, 3, on_ble_event, NULL);
 }
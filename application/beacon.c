@@ -18,20 +18,28 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "beacon.h"
 
+#include "battery_history.h"
 #include "battery_service.h"
 #include "beacon_config.h"
 #include "beacon_config_service.h"
+#include "beacon_config_storage.h"
 #include "config.h"
 #include "dfu.h"
+#include "energy.h"
+#include "flash_record.h"
 #include "indicator.h"
+#include "lesc.h"
+#include "link_profile.h"
+#include "power.h"
 
 #include "app_timer.h"
 #include "ble_advdata.h"
-#include "ble_conn_params.h"
 #include "ble_conn_state.h"
 #include "fds.h"
 #include "nrf_ble_gatt.h"
@@ -43,7 +51,6 @@
 #include "peer_manager.h"
 
 static ble_gap_sec_params_t m_sec_params;
-static uint16_t m_connection_handle = BLE_CONN_HANDLE_INVALID;
 static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
 static uint8_t m_enc_advdata[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
 static uint8_t m_enc_scan_response_data_not_connectable[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
@@ -51,7 +58,10 @@ static uint8_t m_enc_scan_response_data_connectable[BLE_GAP_ADV_SET_DATA_SIZE_MA
 static bool m_connectable = false;
 
 NRF_BLE_GATT_DEF(m_gatt);
-NRF_BLE_QWR_DEF(m_qwr);
+NRF_BLE_QWRS_DEF(m_qwr, NRF_SDH_BLE_TOTAL_LINK_COUNT);
+
+// Queued (long) writes of the bulk config characteristic, per link.
+static uint8_t m_qwr_buffer[NRF_SDH_BLE_TOTAL_LINK_COUNT][256];
 
 static ble_gap_adv_data_t m_adv_data_not_connectable =
   {
@@ -85,26 +95,50 @@ static void
 on_ble_event(ble_evt_t const *ble_evt, void *context)
 {
   uint32_t err_code = NRF_SUCCESS;
+  uint16_t conn_handle = ble_evt->evt.gap_evt.conn_handle;
 
   switch (ble_evt->header.evt_id)
     {
     case BLE_GAP_EVT_CONNECTED:
       NRF_LOG_INFO("Connected.\r\n");
 
-      m_connection_handle = ble_evt->evt.gap_evt.conn_handle;
-      beacon_start_advertising_non_connectable();
+      // The SoftDevice stopped connectable advertising; keep it up while
+      // there is room for another session.
+      if (m_connectable && beacon_has_free_link())
+        {
+          beacon_start_advertising_connectable();
+        }
+      else
+        {
+          beacon_start_advertising_non_connectable();
+        }
       indicator_start_loop(flash_three_times_indicator);
 
-      err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_connection_handle);
+      err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr[ble_conn_state_conn_idx(conn_handle)], conn_handle);
       APP_ERROR_CHECK(err_code);
+
+      // Config sessions move a lot of data in few round trips; ask for 2M.
+      {
+        ble_gap_phys_t const phys =
+          {
+           .rx_phys = BLE_GAP_PHY_2MBPS,
+           .tx_phys = BLE_GAP_PHY_2MBPS,
+          };
+        err_code = sd_ble_gap_phy_update(conn_handle, &phys);
+        if (err_code != NRF_ERROR_INVALID_STATE && err_code != NRF_ERROR_BUSY)
+          {
+            APP_ERROR_CHECK(err_code);
+          }
+      }
       break;
 
     case BLE_GAP_EVT_DISCONNECTED:
       NRF_LOG_INFO("Disconnected.\r\n");
 
-      m_connection_handle = BLE_CONN_HANDLE_INVALID;
-
-      indicator_stop();
+      if (!beacon_is_connected())
+        {
+          indicator_stop();
+        }
       beacon_start_advertising();
       break;
 
@@ -120,12 +154,21 @@ on_ble_event(ble_evt_t const *ble_evt, void *context)
       }
       break;
 
+    case BLE_GAP_EVT_PHY_UPDATE:
+      NRF_LOG_INFO("PHY updated: tx %d, rx %d.",
+                   ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                   ble_evt->evt.gap_evt.params.phy_update.rx_phy);
+      break;
+
     case BLE_GAP_EVT_ADV_SET_TERMINATED:
       NRF_LOG_DEBUG("Advertising timeout.");
-      if (!beacon_is_connected())
-        {
-          beacon_start_advertising();
-        }
+      beacon_config_service_adv_mode_set(BEACON_ADV_MODE_STOPPED);
+      energy_advertising_set(0, 0);
+
+      // Connectable advertising also runs while links are up, so it can time
+      // out with a link connected. Without a free link this falls back to
+      // non-connectable advertising.
+      beacon_start_advertising();
       break;
 
     case BLE_GATTC_EVT_TIMEOUT:
@@ -151,6 +194,75 @@ on_ble_event(ble_evt_t const *ble_evt, void *context)
     }
 }
 
+// Flash words that peer manager uses per bond: the bonding data, the rank,
+// the GATT server state with the CCCDs of the status, history, battery level
+// and service changed characteristics, and the service changed flag.
+#define BOND_CCCD_COUNT 4
+#define BOND_FLASH_WORDS                                                \
+  (FLASH_RECORD_FLASH_WORDS(sizeof(pm_peer_data_bonding_t)) +           \
+   FLASH_RECORD_FLASH_WORDS(sizeof(uint32_t)) +                         \
+   FLASH_RECORD_FLASH_WORDS(offsetof(pm_peer_data_local_gatt_db_t, data) + BOND_CCCD_COUNT * 6 + 2) + \
+   FLASH_RECORD_FLASH_WORDS(sizeof(bool)))
+
+// Flash words of the application's own records.
+#define APP_FLASH_WORDS                                                 \
+  (FLASH_RECORD_FLASH_WORDS(sizeof(beacon_config_storage_t)) +          \
+   (BATTERY_HISTORY_RECORDS + 1) * FLASH_RECORD_FLASH_WORDS(sizeof(battery_history_record_t)) + \
+   FLASH_RECORD_FLASH_WORDS(ENERGY_RECORD_SIZE))
+
+// FDS keeps one page free for garbage collection and a two word header on
+// every other page.
+#define FDS_FLASH_WORDS ((FDS_VIRTUAL_PAGES - 1) * (FDS_VIRTUAL_PAGE_SIZE - 2))
+
+STATIC_ASSERT(APP_FLASH_WORDS + BEACON_MAX_BONDS * BOND_FLASH_WORDS <= FDS_FLASH_WORDS);
+
+// Deletes the least recently used bond of a peer that is not connected.
+// Returns false if there is none.
+static bool
+bond_evict()
+{
+  pm_peer_id_t lowest_peer = PM_PEER_ID_INVALID;
+  uint32_t lowest_rank = UINT32_MAX;
+
+  pm_peer_id_t peer = pm_next_peer_id_get(PM_PEER_ID_INVALID);
+  while (peer != PM_PEER_ID_INVALID)
+    {
+      uint16_t conn_handle = BLE_CONN_HANDLE_INVALID;
+      ret_code_t err_code = pm_conn_handle_get(peer, &conn_handle);
+      APP_ERROR_CHECK(err_code);
+
+      if (conn_handle == BLE_CONN_HANDLE_INVALID)
+        {
+          // Peers that were never ranked are the least recently used.
+          uint32_t rank = 0;
+          uint32_t len = sizeof(rank);
+          err_code = pm_peer_data_load(peer, PM_PEER_DATA_ID_PEER_RANK, &rank, &len);
+          if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_NOT_FOUND)
+            {
+              APP_ERROR_CHECK(err_code);
+            }
+
+          if (lowest_peer == PM_PEER_ID_INVALID || rank < lowest_rank)
+            {
+              lowest_peer = peer;
+              lowest_rank = rank;
+            }
+        }
+
+      peer = pm_next_peer_id_get(peer);
+    }
+
+  if (lowest_peer == PM_PEER_ID_INVALID)
+    {
+      return false;
+    }
+
+  NRF_LOG_INFO("Evicting least recently used bond %d.", lowest_peer);
+  ret_code_t err_code = pm_peer_delete(lowest_peer);
+  APP_ERROR_CHECK(err_code);
+  return true;
+}
+
 static void
 pm_evt_handler(pm_evt_t const * p_evt)
 {
@@ -166,6 +278,19 @@ pm_evt_handler(pm_evt_t const * p_evt)
 
     case PM_EVT_CONN_SEC_SUCCEEDED:
       {
+        // Keep the bond ranks in order of last use. A failed update is
+        // retried on the next connection.
+        err_code = pm_peer_rank_highest(p_evt->peer_id);
+        if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_BUSY && err_code != NRF_ERROR_STORAGE_FULL)
+          {
+            NRF_LOG_WARNING("Failed to update bond rank (%d).", err_code);
+          }
+
+        if (p_evt->params.conn_sec_succeeded.procedure == PM_CONN_SEC_PROCEDURE_BONDING &&
+            pm_peer_count() > BEACON_MAX_BONDS)
+          {
+            (void) bond_evict();
+          }
       }
       break;
 
@@ -184,7 +309,12 @@ pm_evt_handler(pm_evt_t const * p_evt)
 
     case PM_EVT_STORAGE_FULL:
       {
-        // Run garbage collection on the flash.
+        // Flash is shared with the application records, so it can fill up
+        // below BEACON_MAX_BONDS. Make room by dropping the least recently
+        // used bond, then run garbage collection on the flash. FDS runs both
+        // in order.
+        (void) bond_evict();
+
         err_code = fds_gc();
         if (err_code == FDS_ERR_NO_SPACE_IN_QUEUES)
           {
@@ -253,7 +383,7 @@ static void
 gap_privacy_init()
 {
   beacon_config_t *config = beacon_config_get();
-  if (config->interval > 0 && !m_connectable)
+  if (config->rotation > 0 && !m_connectable)
     {
       ble_gap_irk_t irk = { 0 };
       memcpy(&irk.irk, config->irk, BLE_GAP_SEC_KEY_LEN);
@@ -261,7 +391,7 @@ gap_privacy_init()
       pm_privacy_params_t privacy_params = {0};
       privacy_params.privacy_mode = BLE_GAP_PRIVACY_MODE_DEVICE_PRIVACY;
       privacy_params.private_addr_type = BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_RESOLVABLE;
-      privacy_params.private_addr_cycle_s = config->interval * 60;
+      privacy_params.private_addr_cycle_s = config->rotation;
       privacy_params.p_device_irk = &irk;
 
       uint32_t err_code = pm_privacy_set(&privacy_params);
@@ -279,6 +409,20 @@ gap_privacy_init()
       err_code = pm_privacy_set(&privacy_params);
       APP_ERROR_CHECK(err_code);
     }
+
+  beacon_config_service_status_notify(BEACON_STATUS_EVENT_PRIVACY_RELOADED);
+}
+
+// Advertising interval (ms).
+static uint16_t
+adv_interval()
+{
+  uint16_t interval = beacon_config_get()->adv_interval;
+  if (power_battery_state() == POWER_BATTERY_CRITICAL)
+    {
+      interval = MAX(interval, BATTERY_CRITICAL_ADV_INTERVAL);
+    }
+  return interval;
 }
 
 static void
@@ -324,8 +468,15 @@ gap_txpower_init()
       power = 4;
     }
 
+  if (power_battery_state() == POWER_BATTERY_CRITICAL && power > BATTERY_CRITICAL_POWER)
+    {
+      power = BATTERY_CRITICAL_POWER;
+    }
+
   ret_code_t err_code = sd_ble_gap_tx_power_set(BLE_GAP_TX_POWER_ROLE_ADV, m_adv_handle, power);
   APP_ERROR_CHECK(err_code);
+
+  energy_advertising_set(adv_interval(), power);
 }
 
 static void
@@ -343,7 +494,6 @@ static void
 gap_params_init()
 {
   uint32_t err_code;
-  ble_gap_conn_params_t gap_conn_params;
   ble_gap_conn_sec_mode_t sec_mode;
 
   BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
@@ -353,16 +503,6 @@ gap_params_init()
 
   err_code = sd_ble_gap_appearance_set(BLE_APPEARANCE_GENERIC_TAG);
   APP_ERROR_CHECK(err_code);
-
-  memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-  gap_conn_params.min_conn_interval = MSEC_TO_UNITS(100, UNIT_1_25_MS);
-  gap_conn_params.max_conn_interval = MSEC_TO_UNITS(200, UNIT_1_25_MS);
-  gap_conn_params.slave_latency = 0;
-  gap_conn_params.conn_sup_timeout = MSEC_TO_UNITS(4000, UNIT_10_MS);
-
-  err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
-  APP_ERROR_CHECK(err_code);
-
 }
 
 static void
@@ -372,10 +512,31 @@ gap_init()
   gap_privacy_init();
 }
 
+static void
+on_gatt_event(nrf_ble_gatt_t *gatt, nrf_ble_gatt_evt_t const *evt)
+{
+  switch (evt->evt_id)
+    {
+    case NRF_BLE_GATT_EVT_ATT_MTU_UPDATED:
+      NRF_LOG_INFO("ATT MTU updated to %d.", evt->params.att_mtu_effective);
+      break;
+
+    case NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED:
+      NRF_LOG_INFO("Data length updated to %d.", evt->params.data_length);
+      break;
+
+    default:
+      break;
+    }
+}
+
 static void
 gatt_init()
 {
-  ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+  ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, on_gatt_event);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = nrf_ble_gatt_att_mtu_periph_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
   APP_ERROR_CHECK(err_code);
 }
 
@@ -385,10 +546,16 @@ qwr_service_init()
   nrf_ble_qwr_init_t qwr_init = {0};
   uint32_t err_code = NRF_SUCCESS;
 
-  qwr_init.error_handler = nrf_qwr_error_handler;
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      qwr_init.error_handler = nrf_qwr_error_handler;
+      qwr_init.mem_buffer.p_mem = m_qwr_buffer[i];
+      qwr_init.mem_buffer.len = sizeof(m_qwr_buffer[i]);
+      qwr_init.callback = beacon_config_service_on_qwr_event;
 
-  err_code = nrf_ble_qwr_init(&m_qwr, &qwr_init);
-  APP_ERROR_CHECK(err_code);
+      err_code = nrf_ble_qwr_init(&m_qwr[i], &qwr_init);
+      APP_ERROR_CHECK(err_code);
+    }
 }
 
 static void
@@ -421,46 +588,40 @@ advertising_data_init()
 }
 
 static void
-services_init()
-{
-  battery_service_init();
-  beacon_config_service_init();
-  qwr_service_init();
-  dfu_services_init();
-}
-
-static void
-on_conn_params_event(ble_conn_params_evt_t * evt)
+advertising_stop()
 {
-  if (evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+  if (m_adv_handle != BLE_GAP_ADV_SET_HANDLE_NOT_SET)
     {
-      uint32_t err_code = sd_ble_gap_disconnect(m_connection_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-      APP_ERROR_CHECK(err_code);
+      uint32_t err_code = sd_ble_gap_adv_stop(m_adv_handle);
+      if (err_code != NRF_ERROR_INVALID_STATE)
+        {
+          APP_ERROR_CHECK(err_code);
+        }
     }
+  energy_advertising_set(0, 0);
 }
 
 static void
-on_conn_params_error(uint32_t error)
+on_config_applied()
 {
-  APP_ERROR_HANDLER(error);
+  gap_pin_init();
+
+  // Apply the new interval, power and address rotation. A commit on
+  // disconnect arrives after advertising was already restarted with the old
+  // config.
+  if (!power_is_failing())
+    {
+      beacon_start_advertising();
+    }
 }
 
 static void
-conn_params_init()
+services_init()
 {
-  ble_conn_params_init_t conn_params_init;
-  memset(&conn_params_init, 0, sizeof(conn_params_init));
-
-  conn_params_init.first_conn_params_update_delay = APP_TIMER_TICKS(5000);
-  conn_params_init.next_conn_params_update_delay  = APP_TIMER_TICKS(30000);
-  conn_params_init.max_conn_params_update_count   = 3;
-  conn_params_init.start_on_notify_cccd_handle    = BLE_GATT_HANDLE_INVALID;
-  conn_params_init.disconnect_on_fail             = false;
-  conn_params_init.evt_handler                    = on_conn_params_event;
-  conn_params_init.error_handler                  = on_conn_params_error;
-
-  uint32_t err_code = ble_conn_params_init(&conn_params_init);
-  APP_ERROR_CHECK(err_code);
+  qwr_service_init();
+  battery_service_init();
+  beacon_config_service_init(&m_gatt, m_qwr, NRF_SDH_BLE_TOTAL_LINK_COUNT, on_config_applied);
+  dfu_services_init();
 }
 
 static void
@@ -471,11 +632,13 @@ peer_manager_init()
   err_code = pm_init();
   APP_ERROR_CHECK(err_code);
 
+  lesc_init();
+
   memset(&m_sec_params, 0, sizeof(ble_gap_sec_params_t));
 
   m_sec_params.bond           = 1;
   m_sec_params.mitm           = 1;
-  m_sec_params.lesc           = 0;
+  m_sec_params.lesc           = 1;
   m_sec_params.keypress       = 0;
   m_sec_params.io_caps        = BLE_GAP_IO_CAPS_DISPLAY_ONLY;
   m_sec_params.oob            = 0;
@@ -503,7 +666,7 @@ beacon_init()
   gatt_init();
   advertising_data_init();
   services_init();
-  conn_params_init();
+  link_profile_init();
 
   NRF_SDH_BLE_OBSERVER(m_ble_observer, 3, on_ble_event, NULL);
 }
@@ -513,7 +676,13 @@ beacon_start_advertising_connectable()
 {
   beacon_config_t *config = beacon_config_get();
 
-  beacon_stop_advertising();
+  // Connections may pair and change the config, both of which write to flash.
+  if (power_is_failing() || power_is_shipping() || !power_flash_allowed())
+    {
+      return;
+    }
+
+  advertising_stop();
   m_connectable = true;
 
   gap_privacy_init();
@@ -525,7 +694,7 @@ beacon_start_advertising_connectable()
   adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
   adv_params.p_peer_addr     = NULL;
   adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
-  adv_params.interval        = MSEC_TO_UNITS(config->adv_interval, UNIT_0_625_MS);
+  adv_params.interval        = MSEC_TO_UNITS(adv_interval(), UNIT_0_625_MS);
 
   uint32_t err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data_connectable, &adv_params);
   APP_ERROR_CHECK(err_code);
@@ -534,6 +703,8 @@ beacon_start_advertising_connectable()
   APP_ERROR_CHECK(err_code);
   gap_txpower_init();
 
+  beacon_config_service_adv_mode_set(BEACON_ADV_MODE_CONNECTABLE);
+
   if (! config->remain_connectable)
     {
       indicator_start_loop(flash_once_indicator);
@@ -543,9 +714,7 @@ beacon_start_advertising_connectable()
 void
 beacon_start_advertising_non_connectable()
 {
-  beacon_config_t *config = beacon_config_get();
-
-  beacon_stop_advertising();
+  advertising_stop();
   m_connectable = false;
 
   gap_privacy_init();
@@ -557,7 +726,7 @@ beacon_start_advertising_non_connectable()
   adv_params.properties.type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_SCANNABLE_UNDIRECTED;
   adv_params.p_peer_addr     = NULL;
   adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
-  adv_params.interval        = MSEC_TO_UNITS(config->adv_interval, UNIT_0_625_MS);
+  adv_params.interval        = MSEC_TO_UNITS(adv_interval(), UNIT_0_625_MS);
 
   uint32_t err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data_not_connectable, &adv_params);
 
@@ -568,6 +737,8 @@ beacon_start_advertising_non_connectable()
 
   gap_txpower_init();
 
+  beacon_config_service_adv_mode_set(BEACON_ADV_MODE_NON_CONNECTABLE);
+
   indicator_stop();
 }
 
@@ -575,7 +746,12 @@ void
 beacon_start_advertising()
 {
   beacon_config_t *config = beacon_config_get();
-  if (config->remain_connectable)
+  if (power_is_failing() || power_is_shipping())
+    {
+      return;
+    }
+
+  if (config->remain_connectable && beacon_has_free_link() && power_flash_allowed())
     {
       beacon_start_advertising_connectable();
     }
@@ -588,9 +764,17 @@ beacon_start_advertising()
 void
 beacon_stop_advertising()
 {
-  if (m_adv_handle != BLE_GAP_ADV_SET_HANDLE_NOT_SET)
+  advertising_stop();
+  beacon_config_service_adv_mode_set(BEACON_ADV_MODE_STOPPED);
+}
+
+void
+beacon_disconnect()
+{
+  ble_conn_state_conn_handle_list_t links = ble_conn_state_periph_handles();
+  for (uint32_t i = 0; i < links.len; i++)
     {
-      uint32_t err_code = sd_ble_gap_adv_stop(m_adv_handle);
+      uint32_t err_code = sd_ble_gap_disconnect(links.conn_handles[i], BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
       if (err_code != NRF_ERROR_INVALID_STATE)
         {
           APP_ERROR_CHECK(err_code);
@@ -601,5 +785,11 @@ beacon_stop_advertising()
 bool
 beacon_is_connected()
 {
-  return m_connection_handle != BLE_CONN_HANDLE_INVALID;
+  return ble_conn_state_peripheral_conn_count() > 0;
+}
+
+bool
+beacon_has_free_link()
+{
+  return ble_conn_state_peripheral_conn_count() < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT;
 }
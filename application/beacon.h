@@ -30,6 +30,8 @@ void beacon_start_advertising_connectable();
 void beacon_start_advertising_non_connectable();
 void beacon_start_advertising();
 void beacon_stop_advertising();
+void beacon_disconnect();
 bool beacon_is_connected();
+bool beacon_has_free_link();
 
 #endif // BEACON_H
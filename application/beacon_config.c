@@ -18,45 +18,71 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "beacon_config.h"
+#include "beacon_config_storage.h"
 #include "config.h"
+#include "flash_record.h"
+#include "power.h"
 
 #include "app_error.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "crc16.h"
 #include "fds.h"
+#include "nrf.h"
+#include "nrf_pwr_mgmt.h"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 
-static const uint32_t MAGIC = 0x7F5849B1;
+static const uint32_t FACTORY_MAGIC = 0x56505242;
 
 #define CONFIG_FILE     (0xF010)
 #define CONFIG_REC_KEY  (0x7010)
 
+// Per-device factory defaults, programmed into the UICR customer area by
+// tools/provision.py. The CRC covers all preceding fields.
 typedef struct
 {
   uint32_t magic;
-  uint16_t version;
-  beacon_config_t config;
-} storage_t;
+  uint8_t pin[8];
+  uint8_t irk[BLE_GAP_SEC_KEY_LEN];
+  uint16_t reserved;
+  uint16_t crc;
+} factory_record_t;
 
-static storage_t m_storage =
+STATIC_ASSERT(sizeof(factory_record_t) <= sizeof(NRF_UICR->CUSTOMER));
+
+#define FACTORY_RECORD ((factory_record_t const *) NRF_UICR->CUSTOMER)
+
+static beacon_config_storage_t m_storage =
   {
    .magic = 0,
    .version = 0,
    .config = {},
   };
 
-static fds_record_t const m_record =
+#define CONFIG_RECORD_WORDS ((sizeof(m_storage) + 3) / sizeof(uint32_t))
+
+static void on_config_written();
+
+static flash_record_t m_flash_record =
   {
-   .file_id           = CONFIG_FILE,
-   .key               = CONFIG_REC_KEY,
-   .data.p_data       = &m_storage,
-   .data.length_words = (sizeof(m_storage) + 3) / sizeof(uint32_t),
+   .file_id = CONFIG_FILE,
+   .key     = CONFIG_REC_KEY,
+   .replace = true,
+   .written = on_config_written,
   };
 
 static bool volatile m_fds_initialized;
+static bool m_save_pending = false;
+static uint32_t m_save_pending_since = 0;
+static beacon_config_saved_callback_t m_saved_callback;
+
+APP_TIMER_DEF(m_save_timer_id);
 
 static void
 fds_evt_handler(fds_evt_t const * evt)
@@ -72,55 +98,144 @@ fds_evt_handler(fds_evt_t const * evt)
         }
       break;
 
-    case FDS_EVT_WRITE:
-      {
-        if (evt->result == FDS_SUCCESS)
-          {
-            NRF_LOG_INFO("Record ID:\t0x%04x",  evt->write.record_id);
-            NRF_LOG_INFO("File ID:\t0x%04x",    evt->write.file_id);
-            NRF_LOG_INFO("Record key:\t0x%04x", evt->write.record_key);
-          }
-      }
-      break;
-
     default:
       break;
     }
+
+  flash_record_on_fds_evt(&m_flash_record, evt);
+}
+
+static void
+on_config_written()
+{
+  NRF_LOG_INFO("Config saved.");
+
+  if (m_saved_callback != NULL)
+    {
+      m_saved_callback();
+    }
+}
+
+static bool
+factory_record_valid()
+{
+  const factory_record_t *factory = FACTORY_RECORD;
+
+  if (factory->magic != FACTORY_MAGIC)
+    {
+      return false;
+    }
+
+  uint16_t crc = crc16_compute((const uint8_t *) factory, offsetof(factory_record_t, crc), NULL);
+  if (crc != factory->crc)
+    {
+      NRF_LOG_WARNING("Factory record CRC mismatch.");
+      return false;
+    }
+
+  return beacon_config_pin_valid(factory->pin);
 }
 
 static void
 beacon_config_set_to_defaults()
 {
-  m_storage.magic = MAGIC;
+  m_storage.magic = BEACON_CONFIG_MAGIC;
   m_storage.version = BEACON_CONFIG_VERSION;
-  m_storage.config.interval = BEACON_CONFIG_INTERVAL;
+  m_storage.config.rotation = BEACON_CONFIG_ROTATION;
   m_storage.config.remain_connectable = BEACON_CONFIG_REMAIN_CONNECTABLE;
   m_storage.config.adv_interval = BEACON_CONFIG_ADV_INTERVAL;
   m_storage.config.power = BEACON_CONFIG_POWER;
 
-  memcpy(&m_storage.config.pin, BEACON_CONFIG_PIN, 6);
-  m_storage.config.pin[6] = 0;
+  if (factory_record_valid())
+    {
+      NRF_LOG_INFO("Using factory PIN and IRK.");
+      memcpy(&m_storage.config.pin, FACTORY_RECORD->pin, 6);
+      memcpy(&m_storage.config.irk, FACTORY_RECORD->irk, BLE_GAP_SEC_KEY_LEN);
+    }
+  else
+    {
+      memcpy(&m_storage.config.pin, BEACON_CONFIG_PIN, 6);
 
-  char irk[16] = BEACON_CONFIG_IRK;
-  memcpy(&m_storage.config.irk, irk, BLE_GAP_SEC_KEY_LEN);
+      char irk[16] = BEACON_CONFIG_IRK;
+      memcpy(&m_storage.config.irk, irk, BLE_GAP_SEC_KEY_LEN);
+    }
+  m_storage.config.pin[6] = 0;
 }
 
 void
 beacon_config_save()
 {
-  ret_code_t rc;
-  fds_record_desc_t desc = {0};
-  fds_find_token_t tok = {0};
+  if (!power_flash_allowed())
+    {
+      // Saved when the battery recovers.
+      NRF_LOG_WARNING("Battery critical, not saving config.");
+      m_save_pending = true;
+      return;
+    }
 
-  rc = fds_record_find(CONFIG_FILE, CONFIG_REC_KEY, &desc, &tok);
+  flash_record_store(&m_flash_record, &m_storage, CONFIG_RECORD_WORDS);
+}
 
-  if (rc == FDS_SUCCESS)
+void
+beacon_config_flush()
+{
+  if (m_save_pending)
     {
-      rc = fds_record_update(&desc, &m_record);
-      APP_ERROR_CHECK(rc);
+      ret_code_t err_code = app_timer_stop(m_save_timer_id);
+      APP_ERROR_CHECK(err_code);
+
+      m_save_pending = false;
+      beacon_config_save();
     }
 }
 
+void
+beacon_config_schedule_save()
+{
+  uint32_t now = app_timer_cnt_get();
+
+  if (!m_save_pending)
+    {
+      m_save_pending = true;
+      m_save_pending_since = now;
+    }
+
+  // Wait for a quiet period, but never keep a change unsaved for longer than
+  // BEACON_CONFIG_SAVE_MAX_DELAY.
+  uint32_t elapsed = app_timer_cnt_diff_compute(now, m_save_pending_since);
+  uint32_t max_delay = APP_TIMER_TICKS(BEACON_CONFIG_SAVE_MAX_DELAY);
+  uint32_t delay = APP_TIMER_TICKS(BEACON_CONFIG_SAVE_DELAY);
+
+  if (elapsed + APP_TIMER_MIN_TIMEOUT_TICKS >= max_delay)
+    {
+      beacon_config_flush();
+      return;
+    }
+  delay = MIN(delay, max_delay - elapsed);
+
+  ret_code_t err_code = app_timer_stop(m_save_timer_id);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_start(m_save_timer_id, delay, NULL);
+  APP_ERROR_CHECK(err_code);
+}
+
+static void
+on_save_timer(void *context)
+{
+  beacon_config_flush();
+}
+
+static bool
+beacon_config_shutdown_handler(nrf_pwr_mgmt_evt_t event)
+{
+  beacon_config_flush();
+
+  return flash_record_shutdown(&m_flash_record);
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(beacon_config_shutdown_handler, 0);
+
 static void
 wait_for_fds_ready()
 {
@@ -131,10 +246,12 @@ wait_for_fds_ready()
 }
 
 void
-beacon_config_init()
+beacon_config_init(beacon_config_saved_callback_t callback)
 {
   ret_code_t rc;
 
+  m_saved_callback = callback;
+
   (void) fds_register(fds_evt_handler);
 
   rc = fds_init();
@@ -142,6 +259,9 @@ beacon_config_init()
 
   wait_for_fds_ready();
 
+  rc = app_timer_create(&m_save_timer_id, APP_TIMER_MODE_SINGLE_SHOT, on_save_timer);
+  APP_ERROR_CHECK(rc);
+
   fds_record_desc_t desc = {0};
   fds_find_token_t tok  = {0};
 
@@ -153,34 +273,37 @@ beacon_config_init()
       rc = fds_record_open(&desc, &record);
       APP_ERROR_CHECK(rc);
 
-      memcpy(&m_storage, record.p_data, sizeof(storage_t));
-
       NRF_LOG_INFO("Config file found.");
-      NRF_LOG_INFO("Magic = %d", m_storage.magic);
-      NRF_LOG_INFO("version = %d", m_storage.version);
-      NRF_LOG_INFO("Interval = %d", m_storage.config.interval);
-      NRF_LOG_INFO("Remain connectable = %d", m_storage.config.remain_connectable);
-      NRF_LOG_INFO("Interval = %d", m_storage.config.adv_interval);
-      NRF_LOG_INFO("Power = %d", m_storage.config.power);
-      NRF_LOG_INFO("Pin = %s", m_storage.config.pin);
+
+      uint32_t stored_size = record.p_header->length_words * sizeof(uint32_t);
+      beacon_config_storage_result_t result = beacon_config_storage_load(&m_storage, record.p_data, stored_size);
 
       rc = fds_record_close(&desc);
       APP_ERROR_CHECK(rc);
 
-      if (m_storage.magic != MAGIC || m_storage.version != BEACON_CONFIG_VERSION)
+      if (result == BEACON_CONFIG_STORAGE_INVALID)
         {
-          NRF_LOG_INFO("Magic/Version incorrect resetting.");
+          NRF_LOG_INFO("Config invalid, resetting.");
           beacon_config_set_to_defaults();
+        }
+
+      NRF_LOG_INFO("Magic = %d", m_storage.magic);
+      NRF_LOG_INFO("version = %d", m_storage.version);
+      NRF_LOG_INFO("Rotation = %d", m_storage.config.rotation);
+      NRF_LOG_INFO("Remain connectable = %d", m_storage.config.remain_connectable);
+      NRF_LOG_INFO("Adv interval = %d", m_storage.config.adv_interval);
+      NRF_LOG_INFO("Power = %d", m_storage.config.power);
+      NRF_LOG_INFO("Pin = %s", m_storage.config.pin);
 
-          rc = fds_record_update(&desc, &m_record);
-          APP_ERROR_CHECK(rc);
+      if (result != BEACON_CONFIG_STORAGE_CURRENT)
+        {
+          flash_record_store(&m_flash_record, &m_storage, CONFIG_RECORD_WORDS);
         }
     }
   else
     {
       beacon_config_set_to_defaults();
-      rc = fds_record_write(&desc, &m_record);
-      APP_ERROR_CHECK(rc);
+      flash_record_store(&m_flash_record, &m_storage, CONFIG_RECORD_WORDS);
     }
 }
 
@@ -188,7 +311,9 @@ void
 beacon_config_reset()
 {
   beacon_config_set_to_defaults();
-  beacon_config_save();
+
+  m_save_pending = true;
+  beacon_config_flush();
 }
 
 beacon_config_t *
@@ -21,23 +21,50 @@
 #ifndef BEACON_CONFIG_H
 #define BEACON_CONFIG_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "ble.h"
 
-#define BEACON_CONFIG_VERSION (3)
+#define BEACON_CONFIG_VERSION (4)
+
+typedef enum
+  {
+    BEACON_CONFIG_TAG_ROTATION = 0x01,
+    BEACON_CONFIG_TAG_REMAIN_CONNECTABLE = 0x02,
+    BEACON_CONFIG_TAG_ADV_INTERVAL = 0x03,
+    BEACON_CONFIG_TAG_POWER = 0x04,
+    BEACON_CONFIG_TAG_PIN = 0x05,
+    BEACON_CONFIG_TAG_IRK = 0x06,
+  } beacon_config_tag_t;
+
+// Bit in the beacon_config_validate() result for an invalid field.
+#define BEACON_CONFIG_FIELD_BIT(tag) (1u << (tag))
+
+// The longest resolvable private address timeout the SoftDevice accepts.
+#define BEACON_CONFIG_ROTATION_MAX (41400)
+#define BEACON_CONFIG_ADV_INTERVAL_MIN (20)
+#define BEACON_CONFIG_ADV_INTERVAL_MAX (10240)
 
 typedef struct
 {
-  uint8_t interval;
+  uint16_t rotation;            // Address rotation period in s, 0 disables privacy.
+  uint16_t adv_interval;        // ms
   uint8_t remain_connectable;
-  uint16_t adv_interval;
-  uint8_t power;
+  int8_t power;                 // dBm
   uint8_t pin[7];
   uint8_t irk[BLE_GAP_SEC_KEY_LEN];
 } beacon_config_t;
 
-void beacon_config_init();
+typedef void (*beacon_config_saved_callback_t)(void);
+
+void beacon_config_init(beacon_config_saved_callback_t callback);
 void beacon_config_save();
+void beacon_config_schedule_save();
+void beacon_config_flush();
 void beacon_config_reset();
 beacon_config_t *beacon_config_get();
+uint16_t beacon_config_validate(const beacon_config_t *config);
+bool beacon_config_pin_valid(const uint8_t *pin);
 
 #endif // BEACON_CONFIG_H
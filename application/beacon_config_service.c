@@ -22,12 +22,23 @@
 #include <stdbool.h>
 
 #include "app_error.h"
+#include "app_util.h"
+#include "ble_conn_state.h"
+#include "ble_srv_common.h"
+#include "nrf_log.h"
 #include "nrf_sdh.h"
 #include "nrf_sdh_ble.h"
 
 #include "beacon_config_service.h"
 #include "beacon_config.h"
-
+#include "beacon_config_tlv.h"
+#include "battery_history.h"
+#include "energy.h"
+#include "energy_calibration.h"
+#include "link_profile.h"
+#include "power.h"
+
+#include <stddef.h>
 #include <string.h>
 
 typedef enum { ACCESS_TYPE_DENY, ACCESS_TYPE_INSECURE, ACCESS_TYPE_SECURE } access_type_t;
@@ -37,43 +48,206 @@ typedef struct
   access_type_t read;
   access_type_t write;
   uint8_t len;
+  uint8_t max_len;
+  bool read_authorize;
+  bool write_authorize;
+  bool notify;
   void *value;
+  uint8_t config_offset;
   ble_gatts_char_handles_t *handles;
   const char *description;
   uint8_t format;
+  int8_t exponent;
+  uint16_t unit;
 } characteristic_config_t;
 
+// Bluetooth SIG assigned unit UUIDs.
+#define UNIT_UNITLESS 0x2700
+#define UNIT_SECOND   0x2703
+#define UNIT_PERCENT  0x27ad
+
+// Characteristics without a value buffer expose the config field at
+// config_offset. Writes are authorized so that one link at a time owns the
+// staged config. Reads are authorized so that the owner sees its staged value
+// and every other link the current config.
+#define CONFIG_VALUE(field) .config_offset = offsetof(beacon_config_t, field), .len = sizeof(((beacon_config_t *) 0)->field), .read_authorize = true, .write_authorize = true
+
+static uint8_t m_uuid_type;
 static uint16_t m_service_handle;
-static ble_gatts_char_handles_t m_handles_interval;
+static ble_gatts_char_handles_t m_handles_rotation;
 static ble_gatts_char_handles_t m_handles_remain_connectable;
 static ble_gatts_char_handles_t m_handles_adv_interval;
 static ble_gatts_char_handles_t m_handles_power;
 static ble_gatts_char_handles_t m_handles_irk;
 static ble_gatts_char_handles_t m_handles_pin;
-static uint16_t m_config_changed = false;
+static ble_gatts_char_handles_t m_handles_config;
+static ble_gatts_char_handles_t m_handles_control_point;
+static uint8_t m_config_value[BEACON_CONFIG_TLV_MAX_SIZE];
+static uint8_t m_control_point_value[4];
+static ble_gatts_char_handles_t m_handles_status;
+static uint8_t m_status_value[2];
+static ble_gatts_char_handles_t m_handles_history;
+static uint8_t m_history_value[NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3];
+static uint16_t m_history_len = 0;
+static uint16_t m_history_owner = BLE_CONN_HANDLE_INVALID;
+static ble_gatts_char_handles_t m_handles_capacity;
+static uint8_t m_capacity_value[1];
+static beacon_config_t m_staged;
+static uint16_t m_staged_owner = BLE_CONN_HANDLE_INVALID;
+static beacon_config_applied_callback_t m_applied_callback;
+static nrf_ble_gatt_t *m_gatt;
+
+static const characteristic_config_t m_characteristics[] =
+  {
+   {
+    .uuid = BEACON_CONFIG_UUID_ROTATION_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(rotation),
+    .handles = &m_handles_rotation,
+    .description = "BDA cycle interval",
+    .format = BLE_GATT_CPF_FORMAT_UINT16,
+    .unit = UNIT_SECOND,
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_REMAIN_CONNECTABLE_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(remain_connectable),
+    .handles = &m_handles_remain_connectable,
+    .description = "Remain connectable",
+    .format = BLE_GATT_CPF_FORMAT_BOOLEAN,
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_ADV_INTERVAL_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(adv_interval),
+    .handles = &m_handles_adv_interval,
+    .description = "Adv interval",
+    .format = BLE_GATT_CPF_FORMAT_UINT16,
+    .exponent = -3,
+    .unit = UNIT_SECOND,
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_POWER_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(power),
+    .handles = &m_handles_power,
+    .description = "Power (dBm)",
+    .format = BLE_GATT_CPF_FORMAT_SINT8,
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_PIN_CHAR,
+    .read = ACCESS_TYPE_SECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(pin),
+    .handles = &m_handles_pin,
+    .description = "PIN",
+    .format = BLE_GATT_CPF_FORMAT_UTF8S,
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_IRK_CHAR,
+    .read = ACCESS_TYPE_SECURE,
+    .write = ACCESS_TYPE_SECURE,
+    CONFIG_VALUE(irk),
+    .handles = &m_handles_irk,
+    .description = "IRK",
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_CONFIG_CHAR,
+    .read = ACCESS_TYPE_SECURE,
+    .write = ACCESS_TYPE_SECURE,
+    .len = 0,
+    .max_len = sizeof(m_config_value),
+    .read_authorize = true,
+    .write_authorize = true,
+    .value = m_config_value,
+    .handles = &m_handles_config,
+    .description = "Config",
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_CONTROL_POINT_CHAR,
+    .read = ACCESS_TYPE_SECURE,
+    .write = ACCESS_TYPE_SECURE,
+    .len = sizeof(m_control_point_value),
+    .write_authorize = true,
+    .value = m_control_point_value,
+    .handles = &m_handles_control_point,
+    .description = "Control point",
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_STATUS_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_DENY,
+    .len = sizeof(m_status_value),
+    .notify = true,
+    .value = m_status_value,
+    .handles = &m_handles_status,
+    .description = "Status",
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_BATTERY_HISTORY_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_DENY,
+    .len = 0,
+    .max_len = sizeof(m_history_value),
+    .notify = true,
+    .value = m_history_value,
+    .handles = &m_handles_history,
+    .description = "Battery history",
+   },
+   {
+    .uuid = BEACON_CONFIG_UUID_REMAINING_CAPACITY_CHAR,
+    .read = ACCESS_TYPE_INSECURE,
+    .write = ACCESS_TYPE_DENY,
+    .len = sizeof(m_capacity_value),
+    .read_authorize = true,
+    .value = m_capacity_value,
+    .handles = &m_handles_capacity,
+#if ENERGY_CALIBRATED
+    .description = "Remaining capacity",
+#else
+    .description = "Remaining capacity (uncalibrated)",
+#endif
+    .format = BLE_GATT_CPF_FORMAT_UINT8,
+    .unit = UNIT_PERCENT,
+   },
+  };
 
 static void
 characteristic_add(const characteristic_config_t *characteristic_config)
 {
   uint32_t err_code;
 
-  ble_uuid128_t base_uuid = { BEACON_CONFIG_UUID_BASE };
   ble_uuid_t uuid;
-  err_code = sd_ble_uuid_vs_add(&base_uuid, &uuid.type);
-  APP_ERROR_CHECK(err_code);
+  uuid.type = m_uuid_type;
   uuid.uuid = characteristic_config->uuid;
 
+  uint8_t *value = characteristic_config->value;
+  uint8_t vloc = BLE_GATTS_VLOC_USER;
+  if (value == NULL)
+    {
+      // Every read and write is authorized; the stack copy is never served.
+      value = (uint8_t *) beacon_config_get() + characteristic_config->config_offset;
+      vloc = BLE_GATTS_VLOC_STACK;
+    }
+
   ble_gatts_attr_md_t attr_md;
   memset(&attr_md, 0, sizeof(attr_md));
-  attr_md.vloc    = BLE_GATTS_VLOC_USER;
+  attr_md.vloc    = vloc;
+  attr_md.vlen    = characteristic_config->max_len != 0;
+  attr_md.rd_auth = characteristic_config->read_authorize;
+  attr_md.wr_auth = characteristic_config->write_authorize;
 
   ble_gatts_attr_t attr;
   memset(&attr, 0, sizeof(attr));
   attr.p_uuid    = &uuid;
   attr.p_attr_md = &attr_md;
   attr.init_len  = characteristic_config->len;
-  attr.p_value   = characteristic_config->value;
-  attr.max_len   = characteristic_config->len;
+  attr.p_value   = value;
+  attr.max_len   = characteristic_config->max_len != 0 ? characteristic_config->max_len : characteristic_config->len;
 
   ble_gatts_char_md_t char_md;
   memset(&char_md, 0, sizeof(char_md));
@@ -108,6 +282,18 @@ characteristic_add(const characteristic_config_t *characteristic_config)
       break;
     }
 
+  ble_gatts_attr_md_t cccd_md;
+  if (characteristic_config->notify)
+    {
+      memset(&cccd_md, 0, sizeof(cccd_md));
+      cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+      cccd_md.read_perm = attr_md.read_perm;
+      cccd_md.write_perm = attr_md.read_perm;
+
+      char_md.char_props.notify = 1;
+      char_md.p_cccd_md = &cccd_md;
+    }
+
   if (characteristic_config->description)
   {
     char_md.p_char_user_desc = (uint8_t*) characteristic_config->description;
@@ -119,9 +305,10 @@ characteristic_add(const characteristic_config_t *characteristic_config)
   if (characteristic_config->format != 0)
   {
     pf.format =	characteristic_config->format;
+    pf.exponent = characteristic_config->exponent;
     pf.name_space= BLE_GATT_CPF_NAMESPACE_BTSIG;
     pf.desc= BLE_GATT_CPF_NAMESPACE_DESCRIPTION_UNKNOWN;
-    pf.unit = 0x2700;
+    pf.unit = characteristic_config->unit != 0 ? characteristic_config->unit : UNIT_UNITLESS;
     char_md.p_char_pf = &pf;
   }
 
@@ -129,22 +316,398 @@ characteristic_add(const characteristic_config_t *characteristic_config)
   APP_ERROR_CHECK(err_code);
 }
 
+static const characteristic_config_t *
+find_config_characteristic(uint16_t handle)
+{
+  for (size_t i = 0; i < ARRAY_SIZE(m_characteristics); i++)
+    {
+      if (m_characteristics[i].value == NULL && m_characteristics[i].handles->value_handle == handle)
+        {
+          return &m_characteristics[i];
+        }
+    }
+  return NULL;
+}
+
+static void
+set_result(uint8_t opcode, uint8_t result, uint16_t errors)
+{
+  m_control_point_value[0] = opcode;
+  m_control_point_value[1] = result;
+  uint16_encode(errors, &m_control_point_value[2]);
+}
+
+static void
+staged_reset()
+{
+  m_staged = *beacon_config_get();
+  m_staged_owner = BLE_CONN_HANDLE_INVALID;
+}
+
+static bool
+staged_claim(uint16_t conn_handle)
+{
+  if (m_staged_owner == BLE_CONN_HANDLE_INVALID)
+    {
+      staged_reset();
+      m_staged_owner = conn_handle;
+    }
+  return m_staged_owner == conn_handle;
+}
+
+static bool
+staged_owned_by_other(uint16_t conn_handle)
+{
+  return m_staged_owner != BLE_CONN_HANDLE_INVALID && m_staged_owner != conn_handle;
+}
+
+static uint16_t
+staged_commit()
+{
+  uint16_t errors = beacon_config_validate(&m_staged);
+  if (errors != 0)
+    {
+      set_result(BEACON_CONFIG_OPCODE_COMMIT, BEACON_CONFIG_RESULT_INVALID, errors);
+      return BEACON_CONFIG_STATUS_INVALID;
+    }
+
+  *beacon_config_get() = m_staged;
+  m_staged_owner = BLE_CONN_HANDLE_INVALID;
+  beacon_config_schedule_save();
+
+  set_result(BEACON_CONFIG_OPCODE_COMMIT, BEACON_CONFIG_RESULT_SUCCESS, 0);
+
+  if (m_applied_callback != NULL)
+    {
+      m_applied_callback();
+    }
+  beacon_config_service_status_notify(BEACON_STATUS_EVENT_CONFIG_APPLIED);
+  return BLE_GATT_STATUS_SUCCESS;
+}
+
+static uint16_t
+control_point_write(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+  if (len != 1)
+    {
+      return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+    }
+
+  if (staged_owned_by_other(conn_handle))
+    {
+      return BEACON_CONFIG_STATUS_BUSY;
+    }
+
+  switch (data[0])
+    {
+    case BEACON_CONFIG_OPCODE_COMMIT:
+      return staged_commit();
+
+    case BEACON_CONFIG_OPCODE_ABORT:
+      staged_reset();
+      set_result(BEACON_CONFIG_OPCODE_ABORT, BEACON_CONFIG_RESULT_SUCCESS, 0);
+      return BLE_GATT_STATUS_SUCCESS;
+
+    case BEACON_CONFIG_OPCODE_SHIP:
+      set_result(BEACON_CONFIG_OPCODE_SHIP, BEACON_CONFIG_RESULT_SUCCESS, 0);
+      power_ship();
+      return BLE_GATT_STATUS_SUCCESS;
+
+    default:
+      set_result(data[0], BEACON_CONFIG_RESULT_NOT_SUPPORTED, 0);
+      return BLE_GATT_STATUS_ATTERR_REQUEST_NOT_SUPPORTED;
+    }
+}
+
+// The bulk characteristic commits the staged config with the written fields on top.
+static uint16_t
+config_write(uint16_t conn_handle, const uint8_t *data, uint16_t len, bool apply)
+{
+  if (staged_owned_by_other(conn_handle))
+    {
+      return BEACON_CONFIG_STATUS_BUSY;
+    }
+
+  beacon_config_t new_config = m_staged_owner == conn_handle ? m_staged : *beacon_config_get();
+
+  if (!beacon_config_decode(&new_config, data, len))
+    {
+      return BEACON_CONFIG_STATUS_INVALID;
+    }
+
+  uint16_t errors = beacon_config_validate(&new_config);
+  if (errors != 0)
+    {
+      set_result(BEACON_CONFIG_OPCODE_COMMIT, BEACON_CONFIG_RESULT_INVALID, errors);
+      return BEACON_CONFIG_STATUS_INVALID;
+    }
+
+  if (apply)
+    {
+      m_staged = new_config;
+      m_staged_owner = conn_handle;
+      return staged_commit();
+    }
+  return BLE_GATT_STATUS_SUCCESS;
+}
+
+static void
+config_field_read(uint16_t conn_handle, const characteristic_config_t *characteristic, ble_gatts_rw_authorize_reply_params_t *reply)
+{
+  const beacon_config_t *config = m_staged_owner == conn_handle ? &m_staged : beacon_config_get();
+
+  reply->type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+  reply->params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+  reply->params.read.update = 1;
+  reply->params.read.len = characteristic->len;
+  reply->params.read.p_data = (const uint8_t *) config + characteristic->config_offset;
+}
+
+static void
+config_field_write(uint16_t conn_handle, const characteristic_config_t *characteristic, const ble_gatts_evt_write_t *write, ble_gatts_rw_authorize_reply_params_t *reply)
+{
+  reply->type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+
+  if (!staged_claim(conn_handle))
+    {
+      reply->params.write.gatt_status = BEACON_CONFIG_STATUS_BUSY;
+      return;
+    }
+
+  if (write->offset + write->len > characteristic->len)
+    {
+      reply->params.write.gatt_status = BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+      return;
+    }
+
+  memcpy((uint8_t *) &m_staged + characteristic->config_offset + write->offset, write->data, write->len);
+
+  reply->params.write.gatt_status = BLE_GATT_STATUS_SUCCESS;
+  reply->params.write.update = 1;
+  reply->params.write.offset = write->offset;
+  reply->params.write.len = write->len;
+  reply->params.write.p_data = write->data;
+}
+
+static void
+on_rw_authorize_request(const ble_evt_t *ble_evt)
+{
+  const ble_gatts_evt_rw_authorize_request_t *request = &ble_evt->evt.gatts_evt.params.authorize_request;
+  uint16_t conn_handle = ble_evt->evt.gatts_evt.conn_handle;
+  uint8_t value[BEACON_CONFIG_TLV_MAX_SIZE];
+  const characteristic_config_t *characteristic = NULL;
+
+  ble_gatts_rw_authorize_reply_params_t reply;
+  memset(&reply, 0, sizeof(reply));
+
+  if (request->type == BLE_GATTS_AUTHORIZE_TYPE_READ &&
+      request->request.read.handle == m_handles_config.value_handle)
+    {
+      reply.type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+      reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+
+      // Encode once per (long) read; the remaining blobs are served from the attribute.
+      if (request->request.read.offset == 0)
+        {
+          reply.params.read.update = 1;
+          reply.params.read.len = beacon_config_encode(beacon_config_get(), value, sizeof(value));
+          reply.params.read.p_data = value;
+        }
+    }
+  else if (request->type == BLE_GATTS_AUTHORIZE_TYPE_READ &&
+           request->request.read.handle == m_handles_capacity.value_handle)
+    {
+      // Estimated from the charge used since the battery was inserted.
+      m_capacity_value[0] = energy_remaining_percent();
+
+      reply.type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+      reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+      reply.params.read.update = 1;
+      reply.params.read.len = sizeof(m_capacity_value);
+      reply.params.read.p_data = m_capacity_value;
+    }
+  else if (request->type == BLE_GATTS_AUTHORIZE_TYPE_READ &&
+           (characteristic = find_config_characteristic(request->request.read.handle)) != NULL)
+    {
+      config_field_read(conn_handle, characteristic, &reply);
+    }
+  else if (request->type == BLE_GATTS_AUTHORIZE_TYPE_WRITE &&
+           request->request.write.handle == m_handles_control_point.value_handle &&
+           request->request.write.op == BLE_GATTS_OP_WRITE_REQ)
+    {
+      // The attribute holds the result, not the written opcode.
+      reply.type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+      reply.params.write.gatt_status = control_point_write(conn_handle, request->request.write.data, request->request.write.len);
+    }
+  else if (request->type == BLE_GATTS_AUTHORIZE_TYPE_WRITE &&
+           request->request.write.op == BLE_GATTS_OP_WRITE_REQ &&
+           (characteristic = find_config_characteristic(request->request.write.handle)) != NULL)
+    {
+      config_field_write(conn_handle, characteristic, &request->request.write, &reply);
+    }
+  else if (request->type == BLE_GATTS_AUTHORIZE_TYPE_WRITE &&
+           request->request.write.handle == m_handles_config.value_handle &&
+           request->request.write.op == BLE_GATTS_OP_WRITE_REQ)
+    {
+      const ble_gatts_evt_write_t *write = &request->request.write;
+
+      reply.type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+      reply.params.write.gatt_status = config_write(conn_handle, write->data, write->len, true);
+      reply.params.write.update = 1;
+      reply.params.write.offset = write->offset;
+      reply.params.write.len = write->len;
+      reply.params.write.p_data = write->data;
+    }
+  else
+    {
+      // Queued writes are handled by nrf_ble_qwr.
+      return;
+    }
+
+  uint32_t err_code = sd_ble_gatts_rw_authorize_reply(conn_handle, &reply);
+  if (err_code != NRF_ERROR_INVALID_STATE && err_code != BLE_ERROR_INVALID_CONN_HANDLE)
+    {
+      APP_ERROR_CHECK(err_code);
+    }
+}
+
+uint16_t
+beacon_config_service_on_qwr_event(nrf_ble_qwr_t *qwr, nrf_ble_qwr_evt_t *evt)
+{
+  if (evt->attr_handle != m_handles_config.value_handle)
+    {
+      return BLE_GATT_STATUS_SUCCESS;
+    }
+
+  uint8_t value[BEACON_CONFIG_TLV_MAX_SIZE];
+  uint16_t len = sizeof(value);
+
+  ret_code_t err_code = nrf_ble_qwr_value_get(qwr, evt->attr_handle, value, &len);
+  if (err_code != NRF_SUCCESS)
+    {
+      return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+    }
+
+  return config_write(qwr->conn_handle, value, len, evt->evt_type == NRF_BLE_QWR_EVT_EXECUTE_WRITE);
+}
+
+void
+beacon_config_service_status_notify(beacon_status_event_t event)
+{
+  m_status_value[0] = event;
+
+  ble_conn_state_conn_handle_list_t links = ble_conn_state_periph_handles();
+  for (uint32_t i = 0; i < links.len; i++)
+    {
+      uint16_t len = sizeof(m_status_value);
+
+      ble_gatts_hvx_params_t hvx;
+      memset(&hvx, 0, sizeof(hvx));
+      hvx.handle = m_handles_status.value_handle;
+      hvx.type = BLE_GATT_HVX_NOTIFICATION;
+      hvx.p_len = &len;
+      hvx.p_data = m_status_value;
+
+      // Fails when the client did not subscribe or the queue is full; the
+      // value can still be read.
+      (void) sd_ble_gatts_hvx(links.conn_handles[i], &hvx);
+    }
+}
+
+void
+beacon_config_service_adv_mode_set(beacon_adv_mode_t mode)
+{
+  if (m_status_value[1] != mode)
+    {
+      m_status_value[1] = mode;
+      beacon_config_service_status_notify(BEACON_STATUS_EVENT_ADV_MODE_CHANGED);
+    }
+}
+
+static void
+history_send()
+{
+  while (m_history_owner != BLE_CONN_HANDLE_INVALID)
+    {
+      if (m_history_len == 0)
+        {
+          // Fill each notification up to the ATT MTU of the link.
+          uint16_t size = MIN(sizeof(m_history_value), nrf_ble_gatt_eff_mtu_get(m_gatt, m_history_owner) - 3);
+          m_history_len = battery_history_stream_read(m_history_value, size);
+          if (m_history_len == 0)
+            {
+              m_history_owner = BLE_CONN_HANDLE_INVALID;
+              break;
+            }
+        }
+
+      uint16_t len = m_history_len;
+
+      ble_gatts_hvx_params_t hvx;
+      memset(&hvx, 0, sizeof(hvx));
+      hvx.handle = m_handles_history.value_handle;
+      hvx.type = BLE_GATT_HVX_NOTIFICATION;
+      hvx.p_len = &len;
+      hvx.p_data = m_history_value;
+
+      uint32_t err_code = sd_ble_gatts_hvx(m_history_owner, &hvx);
+      if (err_code == NRF_ERROR_RESOURCES)
+        {
+          // Continues when the queued notifications have been sent.
+          break;
+        }
+      if (err_code != NRF_SUCCESS)
+        {
+          m_history_owner = BLE_CONN_HANDLE_INVALID;
+        }
+      m_history_len = 0;
+    }
+}
+
 static void
 on_write(const ble_evt_t *ble_evt)
 {
-  m_config_changed = true;
+  const ble_gatts_evt_write_t *write = &ble_evt->evt.gatts_evt.params.write;
+  uint16_t conn_handle = ble_evt->evt.gatts_evt.conn_handle;
+
+  if (write->handle != m_handles_history.cccd_handle || write->len != 2)
+    {
+      return;
+    }
+
+  if (ble_srv_is_notification_enabled(write->data))
+    {
+      // One stream at a time; other links can subscribe again later.
+      if (m_history_owner == BLE_CONN_HANDLE_INVALID)
+        {
+          m_history_owner = conn_handle;
+          m_history_len = 0;
+          battery_history_stream_start();
+          history_send();
+        }
+    }
+  else if (m_history_owner == conn_handle)
+    {
+      m_history_owner = BLE_CONN_HANDLE_INVALID;
+    }
 }
 
 static void
 on_disconnect(const ble_evt_t *ble_evt)
 {
-  UNUSED_PARAMETER(ble_evt);
+  // Tools that predate the control point never commit; do it for them.
+  if (m_staged_owner == ble_evt->evt.gap_evt.conn_handle && staged_commit() != BLE_GATT_STATUS_SUCCESS)
+    {
+      NRF_LOG_WARNING("Discarding invalid staged config.");
+      staged_reset();
+    }
 
-  if (m_config_changed)
-  {
-    beacon_config_save();
-    m_config_changed = false;
-  }
+  if (m_history_owner == ble_evt->evt.gap_evt.conn_handle)
+    {
+      m_history_owner = BLE_CONN_HANDLE_INVALID;
+    }
+
+  beacon_config_flush();
 }
 
 static void
@@ -156,106 +719,56 @@ on_ble_event(ble_evt_t const *ble_evt, void *context)
       on_disconnect(ble_evt);
       break;
 
+    case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+      on_rw_authorize_request(ble_evt);
+      break;
+
     case BLE_GATTS_EVT_WRITE:
       on_write(ble_evt);
       break;
 
+    case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+      if (ble_evt->evt.gatts_evt.conn_handle == m_history_owner)
+        {
+          // Keep the link fast while the history is streamed.
+          link_profile_activity(m_history_owner);
+          history_send();
+        }
+      break;
+
     default:
       break;
     }
 }
 
 void
-beacon_config_service_init()
+beacon_config_service_init(nrf_ble_gatt_t *gatt, nrf_ble_qwr_t *qwr, size_t qwr_count, beacon_config_applied_callback_t callback)
 {
+  m_gatt = gatt;
+  m_applied_callback = callback;
+  staged_reset();
+
   ble_uuid128_t base_uuid = { BEACON_CONFIG_UUID_BASE };
+  uint32_t err_code = sd_ble_uuid_vs_add(&base_uuid, &m_uuid_type);
+  APP_ERROR_CHECK(err_code);
+
   ble_uuid_t service_uuid;
+  service_uuid.type = m_uuid_type;
   service_uuid.uuid = BEACON_CONFIG_UUID_CONFIG_SERVICE;
 
-  uint32_t err_code = sd_ble_uuid_vs_add(&base_uuid, &service_uuid.type);
-  APP_ERROR_CHECK(err_code);
-
   err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &service_uuid, &m_service_handle);
   APP_ERROR_CHECK(err_code);
 
-  beacon_config_t *config = beacon_config_get();
-
-  characteristic_config_t interval_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_INTERVAL_CHAR,
-        .read = ACCESS_TYPE_INSECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->interval),
-        .value = &(config->interval),
-        .handles = &m_handles_interval,
-        .description = "BDA cycle interval",
-        .format = BLE_GATT_CPF_FORMAT_UINT8,
-      };
-  characteristic_add(&interval_config);
-
-  characteristic_config_t remain_connectable_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_REMAIN_CONNECTABLE_CHAR,
-        .read = ACCESS_TYPE_INSECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->remain_connectable),
-        .value = &(config->remain_connectable),
-        .handles = &m_handles_remain_connectable,
-        .description = "Remain connectable",
-        .format = BLE_GATT_CPF_FORMAT_BOOLEAN,
-      };
-  characteristic_add(&remain_connectable_config);
-
-  characteristic_config_t adv_interval_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_ADV_INTERVAL_CHAR,
-        .read = ACCESS_TYPE_INSECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->adv_interval),
-        .value = &(config->adv_interval),
-        .handles = &m_handles_adv_interval,
-        .description = "Adv interval",
-        .format = BLE_GATT_CPF_FORMAT_UINT8,
-      };
-  characteristic_add(&adv_interval_config);
-
-  characteristic_config_t power_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_POWER_CHAR,
-        .read = ACCESS_TYPE_INSECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->power),
-        .value = &(config->power),
-        .handles = &m_handles_power,
-        .description = "Power",
-        .format = BLE_GATT_CPF_FORMAT_SINT8,
-      };
-  characteristic_add(&power_config);
-
-  characteristic_config_t pin_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_PIN_CHAR,
-        .read = ACCESS_TYPE_SECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->pin),
-        .value = &(config->pin),
-        .handles = &m_handles_pin,
-        .description = "PIN",
-        .format = BLE_GATT_CPF_FORMAT_UTF8S,
-      };
-  characteristic_add(&pin_config);
-
-  characteristic_config_t irk_config =
-      {
-        .uuid = BEACON_CONFIG_UUID_IRK_CHAR,
-        .read = ACCESS_TYPE_SECURE,
-        .write = ACCESS_TYPE_SECURE,
-        .len = sizeof(config->irk),
-        .value = &(config->irk),
-        .handles = &m_handles_irk,
-        .description = "IRK",
-      };
-  characteristic_add(&irk_config);
+  for (size_t i = 0; i < ARRAY_SIZE(m_characteristics); i++)
+    {
+      characteristic_add(&m_characteristics[i]);
+    }
+
+  for (size_t i = 0; i < qwr_count; i++)
+    {
+      err_code = nrf_ble_qwr_attr_register(&qwr[i], m_handles_config.value_handle);
+      APP_ERROR_CHECK(err_code);
+    }
 
   NRF_SDH_BLE_OBSERVER(m_observer, 3, on_ble_event, NULL);
 }
@@ -21,18 +21,78 @@
 #ifndef BEACON_CONFIG_SERVICE_H
 #define BEACON_CONFIG_SERVICE_H
 
+#include <stddef.h>
+
 #include "ble.h"
+#include "nrf_ble_gatt.h"
+#include "nrf_ble_qwr.h"
 
 // 32296067-f5f3-44cb-8cae-d03455cba9cd
 #define BEACON_CONFIG_UUID_BASE                    {0x32, 0x29, 0x60, 0x67, 0xf5, 0xf3, 0x44, 0xcb, 0x8c, 0xae, 0xd0, 0x34, 0x00, 0x00, 0xa9, 0xcd}
 #define BEACON_CONFIG_UUID_CONFIG_SERVICE          0x2700
-#define BEACON_CONFIG_UUID_INTERVAL_CHAR           0x1000
+#define BEACON_CONFIG_UUID_ROTATION_CHAR           0x1000
 #define BEACON_CONFIG_UUID_REMAIN_CONNECTABLE_CHAR 0x1001
 #define BEACON_CONFIG_UUID_ADV_INTERVAL_CHAR       0x1002
 #define BEACON_CONFIG_UUID_POWER_CHAR              0x1003
 #define BEACON_CONFIG_UUID_PIN_CHAR                0x1004
 #define BEACON_CONFIG_UUID_IRK_CHAR                0x1005
+#define BEACON_CONFIG_UUID_CONFIG_CHAR             0x1006
+#define BEACON_CONFIG_UUID_CONTROL_POINT_CHAR      0x1007
+#define BEACON_CONFIG_UUID_STATUS_CHAR             0x1008
+#define BEACON_CONFIG_UUID_BATTERY_HISTORY_CHAR    0x1009
+#define BEACON_CONFIG_UUID_REMAINING_CAPACITY_CHAR 0x100a
+
+// ATT error returned when a written config is rejected.
+#define BEACON_CONFIG_STATUS_INVALID               BLE_GATT_STATUS_ATTERR_APP_BEGIN
+// ATT error returned when another link has uncommitted config changes.
+#define BEACON_CONFIG_STATUS_BUSY                  (BLE_GATT_STATUS_ATTERR_APP_BEGIN + 1)
+
+// Writes to the individual config characteristics are staged. A write of one
+// of these opcodes to the control point commits or discards them. The control
+// point then reads back the opcode, a result code and a bitmask of invalid
+// fields (BEACON_CONFIG_FIELD_BIT). The first link to write owns the staged
+// config until it commits, aborts or disconnects.
+typedef enum
+  {
+    BEACON_CONFIG_OPCODE_COMMIT = 0x01,
+    BEACON_CONFIG_OPCODE_ABORT = 0x02,
+    // Disconnects and powers off until the button is pressed.
+    BEACON_CONFIG_OPCODE_SHIP = 0x03,
+  } beacon_config_opcode_t;
+
+typedef enum
+  {
+    BEACON_CONFIG_RESULT_SUCCESS = 0x00,
+    BEACON_CONFIG_RESULT_INVALID = 0x01,
+    BEACON_CONFIG_RESULT_NOT_SUPPORTED = 0x02,
+  } beacon_config_result_t;
+
+// The status characteristic notifies the last event and the current
+// advertising mode.
+typedef enum
+  {
+    BEACON_STATUS_EVENT_NONE = 0x00,
+    BEACON_STATUS_EVENT_CONFIG_APPLIED = 0x01,
+    BEACON_STATUS_EVENT_PRIVACY_RELOADED = 0x02,
+    BEACON_STATUS_EVENT_CONFIG_SAVED = 0x03,
+    BEACON_STATUS_EVENT_ADV_MODE_CHANGED = 0x04,
+  } beacon_status_event_t;
+
+typedef enum
+  {
+    BEACON_ADV_MODE_STOPPED = 0x00,
+    BEACON_ADV_MODE_NON_CONNECTABLE = 0x01,
+    BEACON_ADV_MODE_CONNECTABLE = 0x02,
+  } beacon_adv_mode_t;
+
+// Subscribing to the battery history characteristic streams the battery
+// history (see battery_history.h) as a sequence of notifications.
+
+typedef void (*beacon_config_applied_callback_t)(void);
 
-void beacon_config_service_init();
+void beacon_config_service_init(nrf_ble_gatt_t *gatt, nrf_ble_qwr_t *qwr, size_t qwr_count, beacon_config_applied_callback_t callback);
+uint16_t beacon_config_service_on_qwr_event(nrf_ble_qwr_t *qwr, nrf_ble_qwr_evt_t *evt);
+void beacon_config_service_status_notify(beacon_status_event_t event);
+void beacon_config_service_adv_mode_set(beacon_adv_mode_t mode);
 
 #endif // BEACON_CONFIG_SERVICE_H
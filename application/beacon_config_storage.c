@@ -0,0 +1,136 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "beacon_config_storage.h"
+
+#include "app_util.h"
+#include "nrf_log.h"
+
+// Version 3 layout. Frozen; only used to upgrade old records.
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  struct
+  {
+    uint8_t interval;
+    uint8_t remain_connectable;
+    uint16_t adv_interval;
+    uint8_t power;
+    uint8_t pin[7];
+    uint8_t irk[BLE_GAP_SEC_KEY_LEN];
+  } config;
+} storage_v3_t;
+
+// Every layout that was ever stored in flash, oldest first. A layout with an
+// upgrade function can be converted in place into the next version. The last
+// entry describes the current beacon_config_storage_t. All layouts share the
+// magic/version header and may only grow.
+typedef struct
+{
+  uint16_t version;
+  uint16_t size;
+  void (*upgrade)(beacon_config_storage_t *storage);
+} storage_layout_t;
+
+static void
+upgrade_v3(beacon_config_storage_t *storage)
+{
+  storage_v3_t old;
+  memcpy(&old, storage, sizeof(old));
+
+  storage->version = 4;
+  storage->config.rotation = old.config.interval * 60;
+  storage->config.adv_interval = old.config.adv_interval;
+  storage->config.remain_connectable = old.config.remain_connectable;
+  storage->config.power = (int8_t) old.config.power;
+  memcpy(storage->config.pin, old.config.pin, sizeof(storage->config.pin));
+  memcpy(storage->config.irk, old.config.irk, sizeof(storage->config.irk));
+}
+
+static const storage_layout_t m_storage_layouts[] =
+  {
+   { .version = 3, .size = sizeof(storage_v3_t), .upgrade = upgrade_v3 },
+   { .version = 4, .size = sizeof(beacon_config_storage_t), .upgrade = NULL },
+  };
+
+STATIC_ASSERT(sizeof(beacon_config_storage_t) >= sizeof(storage_v3_t));
+
+static const storage_layout_t *
+find_storage_layout(uint16_t version)
+{
+  for (size_t i = 0; i < ARRAY_SIZE(m_storage_layouts); i++)
+    {
+      if (m_storage_layouts[i].version == version)
+        {
+          return &m_storage_layouts[i];
+        }
+    }
+  return NULL;
+}
+
+beacon_config_storage_result_t
+beacon_config_storage_load(beacon_config_storage_t *storage, const void *data, uint32_t size)
+{
+  if (size < offsetof(beacon_config_storage_t, config))
+    {
+      NRF_LOG_INFO("Config record too short.");
+      return BEACON_CONFIG_STORAGE_INVALID;
+    }
+
+  memset(storage, 0, sizeof(*storage));
+  memcpy(storage, data, MIN(size, sizeof(*storage)));
+
+  if (storage->magic != BEACON_CONFIG_MAGIC)
+    {
+      NRF_LOG_INFO("Magic incorrect.");
+      return BEACON_CONFIG_STORAGE_INVALID;
+    }
+
+  const storage_layout_t *layout = find_storage_layout(storage->version);
+  if (layout == NULL || size < layout->size)
+    {
+      NRF_LOG_INFO("Version %d unknown or truncated.", storage->version);
+      return BEACON_CONFIG_STORAGE_INVALID;
+    }
+
+  if (storage->version == BEACON_CONFIG_VERSION)
+    {
+      return BEACON_CONFIG_STORAGE_CURRENT;
+    }
+
+  while (storage->version != BEACON_CONFIG_VERSION)
+    {
+      layout = find_storage_layout(storage->version);
+      if (layout == NULL || layout->upgrade == NULL)
+        {
+          return BEACON_CONFIG_STORAGE_INVALID;
+        }
+
+      NRF_LOG_INFO("Upgrading config from version %d.", storage->version);
+      layout->upgrade(storage);
+    }
+  return BEACON_CONFIG_STORAGE_UPGRADED;
+}
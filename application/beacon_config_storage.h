@@ -0,0 +1,50 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef BEACON_CONFIG_STORAGE_H
+#define BEACON_CONFIG_STORAGE_H
+
+#include <stdint.h>
+
+#include "beacon_config.h"
+
+#define BEACON_CONFIG_MAGIC (0x7F5849B1)
+
+// Config record as stored in flash.
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  beacon_config_t config;
+} beacon_config_storage_t;
+
+typedef enum
+  {
+    BEACON_CONFIG_STORAGE_CURRENT,
+    BEACON_CONFIG_STORAGE_UPGRADED,
+    BEACON_CONFIG_STORAGE_INVALID,
+  } beacon_config_storage_result_t;
+
+// Copies a stored record of size bytes into storage and upgrades it to
+// BEACON_CONFIG_VERSION. An invalid record leaves storage undefined.
+beacon_config_storage_result_t beacon_config_storage_load(beacon_config_storage_t *storage, const void *data, uint32_t size);
+
+#endif // BEACON_CONFIG_STORAGE_H
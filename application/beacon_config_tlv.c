@@ -0,0 +1,128 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "beacon_config_tlv.h"
+
+#include "app_util.h"
+
+typedef struct
+{
+  uint8_t tag;
+  uint8_t offset;
+  uint8_t size;
+} config_field_t;
+
+#define CONFIG_FIELD(tag, field, size) { tag, offsetof(beacon_config_t, field), size }
+
+static const config_field_t m_config_fields[] =
+  {
+   CONFIG_FIELD(BEACON_CONFIG_TAG_ROTATION, rotation, sizeof(uint16_t)),
+   CONFIG_FIELD(BEACON_CONFIG_TAG_REMAIN_CONNECTABLE, remain_connectable, sizeof(uint8_t)),
+   CONFIG_FIELD(BEACON_CONFIG_TAG_ADV_INTERVAL, adv_interval, sizeof(uint16_t)),
+   CONFIG_FIELD(BEACON_CONFIG_TAG_POWER, power, sizeof(int8_t)),
+   CONFIG_FIELD(BEACON_CONFIG_TAG_PIN, pin, 6),
+   CONFIG_FIELD(BEACON_CONFIG_TAG_IRK, irk, BLE_GAP_SEC_KEY_LEN),
+  };
+
+static const config_field_t *
+find_config_field(uint8_t tag)
+{
+  for (size_t i = 0; i < ARRAY_SIZE(m_config_fields); i++)
+    {
+      if (m_config_fields[i].tag == tag)
+        {
+          return &m_config_fields[i];
+        }
+    }
+  return NULL;
+}
+
+uint16_t
+beacon_config_encode(const beacon_config_t *config, uint8_t *data, uint16_t size)
+{
+  uint16_t len = 0;
+
+  if (size < 1)
+    {
+      return 0;
+    }
+  data[len++] = BEACON_CONFIG_TLV_VERSION;
+
+  for (size_t i = 0; i < ARRAY_SIZE(m_config_fields); i++)
+    {
+      const config_field_t *field = &m_config_fields[i];
+
+      if (len + 2 + field->size > size)
+        {
+          return 0;
+        }
+
+      data[len++] = field->tag;
+      data[len++] = field->size;
+      memcpy(&data[len], (const uint8_t *) config + field->offset, field->size);
+      len += field->size;
+    }
+
+  return len;
+}
+
+bool
+beacon_config_decode(beacon_config_t *config, const uint8_t *data, uint16_t len)
+{
+  if (len < 1 || data[0] != BEACON_CONFIG_TLV_VERSION)
+    {
+      return false;
+    }
+
+  uint16_t pos = 1;
+  while (pos < len)
+    {
+      if (pos + 2 > len)
+        {
+          return false;
+        }
+
+      uint8_t tag = data[pos++];
+      uint8_t size = data[pos++];
+
+      if (pos + size > len)
+        {
+          return false;
+        }
+
+      const config_field_t *field = find_config_field(tag);
+      if (field != NULL)
+        {
+          if (size != field->size)
+            {
+              return false;
+            }
+          memcpy((uint8_t *) config + field->offset, &data[pos], size);
+        }
+      pos += size;
+    }
+
+  return true;
+}
@@ -0,0 +1,43 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef BEACON_CONFIG_TLV_H
+#define BEACON_CONFIG_TLV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "beacon_config.h"
+
+// Packed representation used by the bulk config characteristic: a format
+// version byte followed by tag/length/value entries. Unknown tags are skipped.
+#define BEACON_CONFIG_TLV_VERSION (2)
+#define BEACON_CONFIG_TLV_MAX_SIZE (128)
+
+// Encodes config into data. Returns the encoded length, or 0 if size is too
+// small.
+uint16_t beacon_config_encode(const beacon_config_t *config, uint8_t *data, uint16_t size);
+
+// Updates config with the fields present in data. Returns false, possibly
+// after updating some fields, if data is malformed.
+bool beacon_config_decode(beacon_config_t *config, const uint8_t *data, uint16_t len);
+
+#endif // BEACON_CONFIG_TLV_H
@@ -0,0 +1,85 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "beacon_config.h"
+
+#include "app_util.h"
+
+// Transmit power levels (dBm) the SoftDevice accepts on the nRF52832.
+static const int8_t m_tx_powers[] = { -40, -20, -16, -12, -8, -4, 0, 3, 4 };
+
+static bool
+is_valid_power(int8_t power)
+{
+  for (size_t i = 0; i < ARRAY_SIZE(m_tx_powers); i++)
+    {
+      if (m_tx_powers[i] == power)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+bool
+beacon_config_pin_valid(const uint8_t *pin)
+{
+  for (int i = 0; i < 6; i++)
+    {
+      if (pin[i] < '0' || pin[i] > '9')
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+uint16_t
+beacon_config_validate(const beacon_config_t *config)
+{
+  uint16_t errors = 0;
+
+  if (config->rotation > BEACON_CONFIG_ROTATION_MAX)
+    {
+      errors |= BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_ROTATION);
+    }
+  if (config->remain_connectable > 1)
+    {
+      errors |= BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_REMAIN_CONNECTABLE);
+    }
+  if (config->adv_interval < BEACON_CONFIG_ADV_INTERVAL_MIN || config->adv_interval > BEACON_CONFIG_ADV_INTERVAL_MAX)
+    {
+      errors |= BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_ADV_INTERVAL);
+    }
+  if (!is_valid_power(config->power))
+    {
+      errors |= BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_POWER);
+    }
+  if (!beacon_config_pin_valid(config->pin))
+    {
+      errors |= BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_PIN);
+    }
+
+  return errors;
+}
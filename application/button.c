@@ -26,6 +26,7 @@
 
 #include "app_button.h"
 #include "app_timer.h"
+#include "nrf_gpio.h"
 
 static button_callback_t m_callback = NULL;
 static int m_count = 0;
@@ -90,3 +91,9 @@ button_init(button_callback_t callback)
   err_code = app_button_enable();
   APP_ERROR_CHECK(err_code);
 }
+
+void
+button_wakeup_enable()
+{
+  nrf_gpio_cfg_sense_input(BUTTON_PIN, NRF_GPIO_PIN_PULLUP, NRF_GPIO_PIN_SENSE_LOW);
+}
@@ -31,4 +31,7 @@ typedef void (*button_callback_t)(button_event_t event, int duration);
 
 void button_init(button_callback_t callback);
 
+// Lets a button press wake the chip from System OFF.
+void button_wakeup_enable();
+
 #endif // BUTTON_H
@@ -21,15 +21,131 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-// Default settings
+// Default settings. The PIN and IRK are overridden by a per-device factory
+// record in UICR, see tools/provision.py.
 
 #define DEVICE_NAME  "Beacon"
 #define BEACON_CONFIG_PIN "123456"
-#define BEACON_CONFIG_INTERVAL 15
+#define BEACON_CONFIG_ROTATION (15 * 60)
 #define BEACON_CONFIG_REMAIN_CONNECTABLE 0
 #define BEACON_CONFIG_ADV_INTERVAL 350
 #define BEACON_CONFIG_POWER 4
 
+// Config changes are saved after BEACON_CONFIG_SAVE_DELAY ms without further
+// changes, and at most BEACON_CONFIG_SAVE_MAX_DELAY ms after the first change.
+#define BEACON_CONFIG_SAVE_DELAY 2000
+#define BEACON_CONFIG_SAVE_MAX_DELAY 10000
+
+// Cell chemistry, selects the discharge curve used to convert the battery
+// voltage to a level.
+#define BATTERY_CHEMISTRY_CR2032 1
+#define BATTERY_CHEMISTRY_CR2477 2
+#ifndef BATTERY_CHEMISTRY
+#define BATTERY_CHEMISTRY BATTERY_CHEMISTRY_CR2032
+#endif
+
+// Nominal capacity (mAh) of the cell.
+#if BATTERY_CHEMISTRY == BATTERY_CHEMISTRY_CR2032
+#define BATTERY_CAPACITY 225
+#elif BATTERY_CHEMISTRY == BATTERY_CHEMISTRY_CR2477
+#define BATTERY_CAPACITY 1000
+#endif
+
+// Interval (ms) at which the battery level is measured while a link has
+// subscribed to battery level notifications.
+#define BATTERY_SERVICE_INTERVAL 5000
+
+// Forward voltage drop (mV) between the battery and the supply. Measured
+// voltages are supply voltages plus this drop, i.e. battery voltages.
+#define BATTERY_DIODE_DROP 270
+
+// Oversampling of a battery measurement. The legacy ADC has no hardware
+// oversampling and averages BATTERY_SAMPLE_BURST conversions instead.
+#define BATTERY_SAADC_OVERSAMPLE NRF_SAADC_OVERSAMPLE_16X
+#define BATTERY_SAMPLE_BURST 4
+
+// Measured voltages pass a median and exponential filter with a weight of
+// 1 / 2^BATTERY_FILTER_SHIFT for new samples. The reported level only changes
+// when the filtered voltage moves more than BATTERY_HYSTERESIS mV away from
+// the voltage of the last reported level.
+#define BATTERY_FILTER_SHIFT 2
+#define BATTERY_HYSTERESIS 10
+
+// The battery voltage and temperature are logged every BATTERY_HISTORY_INTERVAL
+// minutes. At most BATTERY_HISTORY_RECORDS days are kept in flash, the oldest
+// day is dropped first.
+#define BATTERY_HISTORY_INTERVAL 60
+#define BATTERY_HISTORY_RECORDS 60
+
+// Battery measurements under load are synchronised to the radio. The rested
+// voltage is sampled BATTERY_RADIO_NOTIFICATION_DISTANCE before a radio event
+// and the loaded voltage right after it. BATTERY_RADIO_CURRENT is the average
+// current (uA) drawn during a radio event and is used to estimate the internal
+// resistance of the cell. A measurement is taken every BATTERY_LOAD_INTERVAL ms.
+#define BATTERY_RADIO_NOTIFICATION_DISTANCE NRF_RADIO_NOTIFICATION_DISTANCE_800US
+#define BATTERY_RADIO_CURRENT 7000
+#define BATTERY_LOAD_INTERVAL (10 * 60 * 1000)
+
+// The consumed charge is estimated every ENERGY_INTERVAL ms and saved every
+// ENERGY_SAVE_INTERVAL ms. A voltage based level of at least
+// ENERGY_NEW_BATTERY_LEVEL percent while the estimate says the cell is more
+// than half empty resets the estimate.
+#define ENERGY_INTERVAL 60000
+#define ENERGY_SAVE_INTERVAL (6 * 60 * 60 * 1000)
+#define ENERGY_NEW_BATTERY_LEVEL 95
+
+// Supply voltage (not battery voltage) at which the radio is stopped and
+// pending changes are saved before brownout, and the time (ms) to wait before
+// resuming. 1.8 V supply is 2070 mV battery, below BATTERY_OFF_VOLTAGE, so
+// the comparator only trips on sudden drops the battery states did not see.
+#define POWER_FAIL_THRESHOLD NRF_POWER_THRESHOLD_V18
+#define POWER_FAIL_RECOVERY_DELAY 60000
+
+// Battery voltages (mV, including BATTERY_DIODE_DROP) below which the battery
+// is low or critical. A state is left again when the voltage recovers by
+// BATTERY_STATE_HYSTERESIS. Pending changes are saved when the battery becomes
+// low. A critical battery advertises at reduced power and rate and no longer
+// writes to flash. Below BATTERY_OFF_VOLTAGE the beacon enters System OFF
+// until the button is pressed.
+#define BATTERY_LOW_VOLTAGE 2500
+#define BATTERY_CRITICAL_VOLTAGE 2300
+#define BATTERY_OFF_VOLTAGE 2150
+#define BATTERY_STATE_HYSTERESIS 50
+#define BATTERY_CRITICAL_POWER -8
+#define BATTERY_CRITICAL_ADV_INTERVAL 2000
+
+// Time (ms) between a request for shipping mode and entering System OFF.
+#define POWER_SHIP_DELAY 1000
+
+// Connection parameter profiles. A link uses the active profile while the
+// peer generates GATT traffic and drops to the idle profile after
+// LINK_PROFILE_IDLE_DELAY ms without traffic. A request the central did not
+// follow is repeated after LINK_PROFILE_RETRY_DELAY ms. Intervals and timeouts
+// are in ms. The idle profile stays within the Apple accessory guidelines.
+#define LINK_PROFILE_TICK 1000
+#define LINK_PROFILE_IDLE_DELAY 5000
+#define LINK_PROFILE_RETRY_DELAY 30000
+#define LINK_PROFILE_ACTIVE_MIN_INTERVAL 7.5
+#define LINK_PROFILE_ACTIVE_MAX_INTERVAL 15
+#define LINK_PROFILE_ACTIVE_LATENCY 0
+#define LINK_PROFILE_ACTIVE_TIMEOUT 4000
+#define LINK_PROFILE_IDLE_MIN_INTERVAL 300
+#define LINK_PROFILE_IDLE_MAX_INTERVAL 400
+#define LINK_PROFILE_IDLE_LATENCY 3
+#define LINK_PROFILE_IDLE_TIMEOUT 6000
+
+// Maximum number of bonds. The least recently used bond is deleted to make
+// room for a new one, or when flash is full. beacon.c checks that this many
+// bonds fit in flash next to the application records.
+#define BEACON_MAX_BONDS 8
+
+// Links without GATT traffic from the peer for LINK_IDLE_TIMEOUT ms are
+// disconnected. Links that are not encrypted are disconnected
+// LINK_UNAUTHENTICATED_TIMEOUT ms after connecting, whatever their traffic.
+// A timeout of 0 disables it.
+#define LINK_IDLE_TIMEOUT 60000
+#define LINK_UNAUTHENTICATED_TIMEOUT 15000
+
 
 // hexdump -n 16 -v -e '/1 "0x%02X, " ' /dev/urandon
 #define BEACON_CONFIG_IRK { 0xE7, 0x2C, 0xCA, 0x33, 0xB0, 0x3F, 0xCE, 0xAA, 0x6D, 0x34, 0xCF, 0xD9, 0xF6, 0xC0, 0x3A, 0xC2 }
@@ -57,7 +57,8 @@ app_shutdown_handler(nrf_pwr_mgmt_evt_t event)
   return true;
 }
 
-NRF_PWR_MGMT_HANDLER_REGISTER(app_shutdown_handler, 0);
+// Runs after the config has been saved; the SoftDevice is needed for flash writes.
+NRF_PWR_MGMT_HANDLER_REGISTER(app_shutdown_handler, 1);
 
 static void
 buttonless_dfu_sdh_state_observer(nrf_sdh_state_evt_t state, void *context)
@@ -0,0 +1,347 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "energy.h"
+#include "energy_calibration.h"
+
+#include "config.h"
+#include "flash_record.h"
+#include "power.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "ble.h"
+#include "ble_conn_state.h"
+#include "fds.h"
+#include "nrf.h"
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+#include "nrf_sdh_ble.h"
+
+#define ENERGY_FILE     (0xF012)
+#define ENERGY_REC_KEY  (0x7012)
+#define ENERGY_MAGIC    (0x454e5247)
+
+// Charge is accounted in nC.
+#define NC_PER_MAH 3600000000ULL
+#define CPU_CLOCK_MHZ 64
+
+typedef struct
+{
+  int8_t tx_power;
+  uint32_t charge;
+} adv_charge_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t consumed;
+} energy_storage_t;
+
+STATIC_ASSERT(sizeof(energy_storage_t) == ENERGY_RECORD_SIZE);
+
+typedef struct
+{
+  uint16_t conn_handle;
+  uint16_t interval;
+  uint16_t latency;
+} energy_link_t;
+
+static const adv_charge_t m_adv_charge[] = ENERGY_ADV_EVENT_CHARGE;
+
+APP_TIMER_DEF(m_energy_timer_id);
+
+static energy_storage_t m_storage = { .magic = ENERGY_MAGIC };
+static energy_storage_t m_write_storage;
+static energy_link_t m_links[NRF_SDH_BLE_TOTAL_LINK_COUNT];
+static uint16_t m_adv_interval = 0;
+static uint32_t m_adv_event_charge = 0;
+static uint32_t m_last_cycles = 0;
+static uint32_t m_ticks_since_save = 0;
+static flash_record_t m_flash_record =
+  {
+   .file_id = ENERGY_FILE,
+   .key     = ENERGY_REC_KEY,
+   .replace = true,
+  };
+
+static void
+energy_add(uint64_t charge)
+{
+  CRITICAL_REGION_ENTER();
+  m_storage.consumed += charge;
+  CRITICAL_REGION_EXIT();
+}
+
+void
+energy_flush()
+{
+  if (flash_record_busy(&m_flash_record) || !power_flash_allowed())
+    {
+      return;
+    }
+
+  m_ticks_since_save = 0;
+
+  CRITICAL_REGION_ENTER();
+  m_write_storage = m_storage;
+  CRITICAL_REGION_EXIT();
+
+  flash_record_store(&m_flash_record, &m_write_storage, sizeof(m_write_storage) / sizeof(uint32_t));
+}
+
+static void
+fds_evt_handler(fds_evt_t const *evt)
+{
+  switch (evt->id)
+    {
+    case FDS_EVT_WRITE:
+    case FDS_EVT_UPDATE:
+    case FDS_EVT_DEL_RECORD:
+    case FDS_EVT_DEL_FILE:
+      energy_add(ENERGY_FLASH_WRITE_CHARGE);
+      break;
+
+    case FDS_EVT_GC:
+      energy_add(ENERGY_FLASH_ERASE_CHARGE);
+      break;
+
+    default:
+      break;
+    }
+
+  flash_record_on_fds_evt(&m_flash_record, evt);
+}
+
+static bool
+energy_shutdown_handler(nrf_pwr_mgmt_evt_t event)
+{
+  energy_flush();
+
+  return flash_record_shutdown(&m_flash_record);
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(energy_shutdown_handler, 0);
+
+static void
+on_energy_timer(void *context)
+{
+  uint64_t period = ENERGY_INTERVAL;
+
+  // The cycle counter stops while the CPU sleeps.
+  uint32_t cycles = DWT->CYCCNT;
+  uint64_t active_us = (uint32_t) (cycles - m_last_cycles) / CPU_CLOCK_MHZ;
+  m_last_cycles = cycles;
+
+  uint64_t charge = (period * ENERGY_SLEEP_CURRENT) / 1000;
+  charge += (active_us * ENERGY_CPU_CURRENT) / 1000;
+
+  // Advertising events are delayed by 5 ms on average.
+  if (m_adv_interval != 0)
+    {
+      charge += (period * m_adv_event_charge) / (m_adv_interval + 5);
+    }
+
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      energy_link_t *link = &m_links[i];
+      if (link->conn_handle != BLE_CONN_HANDLE_INVALID && link->interval != 0)
+        {
+          // The interval is in units of 1.25 ms.
+          uint64_t event_period = ((uint64_t) link->interval * 5 * (link->latency + 1)) / 4;
+          charge += (period * ENERGY_CONN_EVENT_CHARGE) / MAX(event_period, 1);
+        }
+    }
+
+  energy_add(charge);
+
+  m_ticks_since_save++;
+  if (m_ticks_since_save >= ENERGY_SAVE_INTERVAL / ENERGY_INTERVAL)
+    {
+      NRF_LOG_INFO("Battery: %d%% remaining by energy estimate.", energy_remaining_percent());
+      energy_flush();
+    }
+}
+
+static energy_link_t *
+link_find(uint16_t conn_handle)
+{
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      if (m_links[i].conn_handle == conn_handle)
+        {
+          return &m_links[i];
+        }
+    }
+  return NULL;
+}
+
+static void
+link_params_set(energy_link_t *link, const ble_gap_conn_params_t *params)
+{
+  if (link != NULL)
+    {
+      link->interval = params->max_conn_interval;
+      link->latency = params->slave_latency;
+    }
+}
+
+static void
+on_ble_event(ble_evt_t const *ble_evt, void *context)
+{
+  uint16_t conn_handle = ble_evt->evt.gap_evt.conn_handle;
+
+  switch (ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_CONNECTED:
+      {
+        energy_link_t *link = link_find(BLE_CONN_HANDLE_INVALID);
+        if (link != NULL)
+          {
+            link->conn_handle = conn_handle;
+            link_params_set(link, &ble_evt->evt.gap_evt.params.connected.conn_params);
+          }
+      }
+      break;
+
+    case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+      link_params_set(link_find(conn_handle), &ble_evt->evt.gap_evt.params.conn_param_update.conn_params);
+      break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+      {
+        energy_link_t *link = link_find(conn_handle);
+        if (link != NULL)
+          {
+            link->conn_handle = BLE_CONN_HANDLE_INVALID;
+          }
+      }
+      break;
+
+    default:
+      break;
+    }
+}
+
+void
+energy_advertising_set(uint16_t interval, int8_t tx_power)
+{
+  m_adv_interval = interval;
+  m_adv_event_charge = m_adv_charge[ARRAY_SIZE(m_adv_charge) - 1].charge;
+
+  for (size_t i = 0; i < ARRAY_SIZE(m_adv_charge); i++)
+    {
+      if (tx_power <= m_adv_charge[i].tx_power)
+        {
+          m_adv_event_charge = m_adv_charge[i].charge;
+          break;
+        }
+    }
+}
+
+void
+energy_battery_measured()
+{
+  energy_add(ENERGY_BATTERY_MEASUREMENT_CHARGE);
+}
+
+uint8_t
+energy_remaining_percent()
+{
+  uint64_t capacity = BATTERY_CAPACITY * NC_PER_MAH;
+  uint64_t consumed = 0;
+
+  CRITICAL_REGION_ENTER();
+  consumed = m_storage.consumed;
+  CRITICAL_REGION_EXIT();
+
+  if (consumed >= capacity)
+    {
+      return 0;
+    }
+  return ((capacity - consumed) * 100) / capacity;
+}
+
+void
+energy_level_update(uint8_t level)
+{
+  // A full cell where the estimate expects a half empty one was replaced.
+  if (level >= ENERGY_NEW_BATTERY_LEVEL && energy_remaining_percent() < 50)
+    {
+      NRF_LOG_INFO("New battery detected.");
+
+      CRITICAL_REGION_ENTER();
+      m_storage.consumed = 0;
+      CRITICAL_REGION_EXIT();
+
+      energy_flush();
+    }
+}
+
+void
+energy_init()
+{
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+
+  (void) fds_register(fds_evt_handler);
+
+  fds_record_desc_t desc = {0};
+  fds_find_token_t tok = {0};
+  if (fds_record_find(ENERGY_FILE, ENERGY_REC_KEY, &desc, &tok) == FDS_SUCCESS)
+    {
+      fds_flash_record_t record = {0};
+      if (fds_record_open(&desc, &record) == FDS_SUCCESS)
+        {
+          const energy_storage_t *stored = record.p_data;
+          if (record.p_header->length_words == sizeof(energy_storage_t) / sizeof(uint32_t) &&
+              stored->magic == ENERGY_MAGIC)
+            {
+              m_storage = *stored;
+            }
+          (void) fds_record_close(&desc);
+        }
+    }
+
+  NRF_LOG_INFO("Battery: %d%% remaining by energy estimate.", energy_remaining_percent());
+
+  // Count CPU cycles to estimate the time the CPU is active.
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  ret_code_t err_code = app_timer_create(&m_energy_timer_id, APP_TIMER_MODE_REPEATED, on_energy_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_start(m_energy_timer_id, APP_TIMER_TICKS(ENERGY_INTERVAL), NULL);
+  APP_ERROR_CHECK(err_code);
+
+  NRF_SDH_BLE_OBSERVER(m_ble_observer, 3, on_ble_event, NULL);
+}
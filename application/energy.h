@@ -0,0 +1,45 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+
+// Estimates the charge drawn from the battery from the radio, ADC, flash and
+// CPU activity, using the charge figures in energy_calibration.h.
+
+// Size (bytes) of the record in which the estimate is saved.
+#define ENERGY_RECORD_SIZE 16
+
+void energy_init();
+void energy_flush();
+
+// Advertising interval (ms) and TX power (dBm); an interval of 0 means that
+// advertising stopped.
+void energy_advertising_set(uint16_t interval, int8_t tx_power);
+void energy_battery_measured();
+
+// The voltage based level is used to detect a new battery.
+void energy_level_update(uint8_t level);
+uint8_t energy_remaining_percent();
+
+#endif // ENERGY_H
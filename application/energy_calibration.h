@@ -0,0 +1,58 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ENERGY_CALIBRATION_H
+#define ENERGY_CALIBRATION_H
+
+// UNCALIBRATED DEFAULTS. These charge estimates are derived from the nRF52832
+// datasheet with the DC/DC converter disabled; none of them was measured on a
+// board, so the remaining capacity is only a rough estimate. All boards share
+// them. Replace them and set ENERGY_CALIBRATED to 1 once measured figures are
+// available.
+#define ENERGY_CALIBRATED 0
+
+// Charge (nC) of one advertising event on three channels, per TX power (dBm).
+#define ENERGY_ADV_EVENT_CHARGE                 \
+  {                                             \
+    { -40, 9000 },                              \
+    { -30, 9200 },                              \
+    { -20, 9600 },                              \
+    { -16, 9900 },                              \
+    { -12, 10300 },                             \
+    { -8, 10900 },                              \
+    { -4, 11700 },                              \
+    { 0, 13000 },                               \
+    { 4, 17500 },                               \
+  }
+
+// Charge (nC) of one connection event without payload.
+#define ENERGY_CONN_EVENT_CHARGE 3800
+
+// Charge (nC) of one battery measurement, one flash write and one page erase.
+#define ENERGY_BATTERY_MEASUREMENT_CHARGE 300
+#define ENERGY_FLASH_WRITE_CHARGE 6000
+#define ENERGY_FLASH_ERASE_CHARGE 650000
+
+// Current (uA) while the CPU runs and current (nA) while sleeping.
+#define ENERGY_CPU_CURRENT 3700
+#define ENERGY_SLEEP_CURRENT 1900
+
+#endif // ENERGY_CALIBRATION_H
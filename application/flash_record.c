@@ -0,0 +1,165 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash_record.h"
+
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+
+static void
+record_write(flash_record_t *record)
+{
+  fds_record_t const fds_record =
+    {
+     .file_id           = record->file_id,
+     .key               = record->key,
+     .data.p_data       = record->data,
+     .data.length_words = record->length_words,
+    };
+
+  fds_record_desc_t desc = {0};
+  fds_find_token_t tok = {0};
+  ret_code_t rc = FDS_ERR_NOT_FOUND;
+  if (record->replace)
+    {
+      rc = fds_record_find(record->file_id, record->key, &desc, &tok);
+    }
+
+  if (rc == FDS_SUCCESS)
+    {
+      rc = fds_record_update(&desc, &fds_record);
+    }
+  else
+    {
+      rc = fds_record_write(&desc, &fds_record);
+    }
+
+  if (rc == FDS_ERR_NO_SPACE_IN_FLASH && !record->gc_requested)
+    {
+      // Retry once after garbage collection.
+      rc = fds_gc();
+      if (rc == FDS_SUCCESS)
+        {
+          record->gc_requested = true;
+          record->retry = true;
+          return;
+        }
+    }
+
+  switch (rc)
+    {
+    case FDS_SUCCESS:
+      record->queued = true;
+      break;
+
+    case FDS_ERR_NO_SPACE_IN_FLASH:
+    case FDS_ERR_NO_SPACE_IN_QUEUES:
+      NRF_LOG_WARNING("Postponing write of record 0x%04x (%d).", record->key, rc);
+      record->retry = true;
+      break;
+
+    default:
+      NRF_LOG_WARNING("Failed to write record 0x%04x (%d).", record->key, rc);
+      record->busy = false;
+      break;
+    }
+}
+
+void
+flash_record_store(flash_record_t *record, void const *data, uint16_t length_words)
+{
+  record->data = data;
+  record->length_words = length_words;
+
+  if (record->busy)
+    {
+      record->again = true;
+      return;
+    }
+
+  record->busy = true;
+  record_write(record);
+}
+
+bool
+flash_record_busy(flash_record_t const *record)
+{
+  return record->busy;
+}
+
+void
+flash_record_on_fds_evt(flash_record_t *record, fds_evt_t const *evt)
+{
+  if ((evt->id == FDS_EVT_WRITE || evt->id == FDS_EVT_UPDATE) && record->queued &&
+      evt->write.file_id == record->file_id && evt->write.record_key == record->key)
+    {
+      record->queued = false;
+      record->busy = false;
+
+      if (evt->result == FDS_SUCCESS)
+        {
+          record->gc_requested = false;
+          if (record->written != NULL)
+            {
+              record->written();
+            }
+        }
+      else
+        {
+          NRF_LOG_WARNING("Failed to write record 0x%04x (%d).", record->key, evt->result);
+        }
+
+      if (record->again)
+        {
+          record->again = false;
+          flash_record_store(record, record->data, record->length_words);
+        }
+    }
+
+  if (record->retry)
+    {
+      record->retry = false;
+      record_write(record);
+    }
+
+  if (record->shutdown_pending && !record->queued)
+    {
+      record->shutdown_pending = false;
+      nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE);
+    }
+}
+
+bool
+flash_record_shutdown(flash_record_t *record)
+{
+  // A write that waits for a retry may never get one; only queued writes
+  // hold up the shutdown.
+  record->shutdown_pending = record->queued;
+  if (record->shutdown_pending)
+    {
+      NRF_LOG_INFO("Postponing shutdown until record 0x%04x is saved.", record->key);
+    }
+  return !record->shutdown_pending;
+}
@@ -0,0 +1,71 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef FLASH_RECORD_H
+#define FLASH_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fds.h"
+
+// A record that a module keeps in flash. Writes that fail for lack of space
+// run garbage collection once; writes that fail for lack of space or queue
+// entries are retried after the next FDS event. A shutdown is postponed while
+// a write is queued.
+typedef struct
+{
+  uint16_t file_id;
+  uint16_t key;
+  // Update the existing record instead of adding a new one.
+  bool replace;
+  // Optional, called after a successful write.
+  void (*written)(void);
+
+  void const *data;
+  uint16_t length_words;
+  bool busy;
+  bool queued;
+  bool again;
+  bool retry;
+  bool gc_requested;
+  bool shutdown_pending;
+} flash_record_t;
+
+// Flash words taken by a record of size bytes, including its FDS header.
+#define FLASH_RECORD_FLASH_WORDS(size) (3 + ((size) + 3) / sizeof(uint32_t))
+
+// Writes length_words words at data, which must stay valid until the write
+// has completed. A write requested while another one is in progress follows
+// it.
+void flash_record_store(flash_record_t *record, void const *data, uint16_t length_words);
+
+// True while a write is queued or waiting to be retried.
+bool flash_record_busy(flash_record_t const *record);
+
+// To be called from the module's FDS event handler.
+void flash_record_on_fds_evt(flash_record_t *record, fds_evt_t const *evt);
+
+// To be called from the module's shutdown handler. Returns false when the
+// shutdown must wait for a queued write.
+bool flash_record_shutdown(flash_record_t *record);
+
+#endif // FLASH_RECORD_H
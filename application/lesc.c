@@ -0,0 +1,171 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lesc.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "ble.h"
+#include "ble_conn_state.h"
+#include "nrf_crypto.h"
+#include "nrf_log.h"
+#include "nrf_sdh_ble.h"
+#include "peer_manager.h"
+
+#define TICKS_TO_MS(ticks) ((uint32_t) (((uint64_t) (ticks) * 1000) / APP_TIMER_CLOCK_FREQ))
+
+typedef struct
+{
+  uint16_t conn_handle;
+  volatile bool dhkey_pending;
+  ble_gap_lesc_p256_pk_t peer_pk;
+  uint32_t pairing_started;
+} lesc_link_t;
+
+static lesc_link_t m_links[NRF_SDH_BLE_TOTAL_LINK_COUNT];
+
+static nrf_crypto_ecc_private_key_t m_private_key;
+static nrf_crypto_ecc_public_key_t m_public_key;
+static ble_gap_lesc_p256_pk_t m_lesc_pk;
+
+static lesc_link_t *
+link_get(uint16_t conn_handle)
+{
+  uint16_t conn_idx = ble_conn_state_conn_idx(conn_handle);
+  if (conn_idx >= NRF_SDH_BLE_TOTAL_LINK_COUNT)
+    {
+      return NULL;
+    }
+  return &m_links[conn_idx];
+}
+
+static void
+dhkey_compute(lesc_link_t *link)
+{
+  uint32_t started = app_timer_cnt_get();
+
+  nrf_crypto_ecc_public_key_t peer_public_key;
+  ble_gap_lesc_dhkey_t dhkey;
+  size_t size = sizeof(dhkey.key);
+
+  ret_code_t err_code = nrf_crypto_ecc_public_key_from_raw(&g_nrf_crypto_ecc_secp256r1_curve_info,
+                                                           &peer_public_key, link->peer_pk.pk, sizeof(link->peer_pk.pk));
+  if (err_code == NRF_SUCCESS)
+    {
+      err_code = nrf_crypto_ecdh_compute(NULL, &m_private_key, &peer_public_key, dhkey.key, &size);
+    }
+
+  if (err_code != NRF_SUCCESS)
+    {
+      // An invalid peer key must fail the DHKey check, not the application.
+      NRF_LOG_WARNING("LESC DHKey computation failed: %d.", err_code);
+      memset(&dhkey, 0, sizeof(dhkey));
+    }
+
+  err_code = sd_ble_gap_lesc_dhkey_reply(link->conn_handle, &dhkey);
+  if (err_code != NRF_ERROR_INVALID_STATE && err_code != BLE_ERROR_INVALID_CONN_HANDLE)
+    {
+      APP_ERROR_CHECK(err_code);
+    }
+
+  NRF_LOG_INFO("LESC DHKey computed in %d ms.", TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), started)));
+}
+
+static void
+on_ble_event(ble_evt_t const *ble_evt, void *context)
+{
+  uint16_t conn_handle = ble_evt->evt.gap_evt.conn_handle;
+  lesc_link_t *link = link_get(conn_handle);
+
+  if (link == NULL)
+    {
+      return;
+    }
+
+  switch (ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+      link->pairing_started = app_timer_cnt_get();
+      break;
+
+    case BLE_GAP_EVT_LESC_DHKEY_REQUEST:
+      // The ECDH computation takes too long for the SoftDevice event
+      // handler; lesc_process() replies from the main loop.
+      link->conn_handle = conn_handle;
+      memcpy(&link->peer_pk, ble_evt->evt.gap_evt.params.lesc_dhkey_request.p_pk_peer, sizeof(link->peer_pk));
+      link->dhkey_pending = true;
+      break;
+
+    case BLE_GAP_EVT_AUTH_STATUS:
+      NRF_LOG_INFO("Pairing %s (status %d, lesc %d) after %d ms.",
+                   ble_evt->evt.gap_evt.params.auth_status.auth_status == BLE_GAP_SEC_STATUS_SUCCESS ? "succeeded" : "failed",
+                   ble_evt->evt.gap_evt.params.auth_status.auth_status,
+                   ble_evt->evt.gap_evt.params.auth_status.lesc,
+                   TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), link->pairing_started)));
+      break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+      link->dhkey_pending = false;
+      break;
+
+    default:
+      break;
+    }
+}
+
+void
+lesc_process()
+{
+  for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    {
+      if (m_links[i].dhkey_pending)
+        {
+          m_links[i].dhkey_pending = false;
+          dhkey_compute(&m_links[i]);
+        }
+    }
+}
+
+void
+lesc_init()
+{
+  uint32_t started = app_timer_cnt_get();
+
+  ret_code_t err_code = nrf_crypto_init();
+  APP_ERROR_CHECK(err_code);
+
+  err_code = nrf_crypto_ecc_key_pair_generate(NULL, &g_nrf_crypto_ecc_secp256r1_curve_info, &m_private_key, &m_public_key);
+  APP_ERROR_CHECK(err_code);
+
+  size_t size = sizeof(m_lesc_pk.pk);
+  err_code = nrf_crypto_ecc_public_key_to_raw(&m_public_key, m_lesc_pk.pk, &size);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = pm_lesc_public_key_set(&m_lesc_pk);
+  APP_ERROR_CHECK(err_code);
+
+  NRF_LOG_INFO("LESC key pair generated in %d ms.", TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), started)));
+
+  NRF_SDH_BLE_OBSERVER(m_ble_observer, 3, on_ble_event, NULL);
+}
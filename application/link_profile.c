@@ -0,0 +1,348 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "link_profile.h"
+
+#include "config.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "ble.h"
+#include "ble_conn_state.h"
+#include "ble_gap.h"
+#include "nrf_log.h"
+#include "nrf_sdh_ble.h"
+
+typedef enum
+  {
+    LINK_PROFILE_NONE,
+    LINK_PROFILE_ACTIVE,
+    LINK_PROFILE_IDLE,
+  } link_profile_t;
+
+typedef struct
+{
+  uint16_t conn_handle;
+  link_profile_t profile;
+  link_profile_t requested;
+  uint32_t request_ticks;
+  uint32_t idle_ticks;
+  uint32_t connected_ticks;
+  bool pairing;
+  bool disconnecting;
+} link_t;
+
+static ble_gap_conn_params_t const m_profiles[] =
+  {
+   [LINK_PROFILE_ACTIVE] =
+   {
+    .min_conn_interval = MSEC_TO_UNITS(LINK_PROFILE_ACTIVE_MIN_INTERVAL, UNIT_1_25_MS),
+    .max_conn_interval = MSEC_TO_UNITS(LINK_PROFILE_ACTIVE_MAX_INTERVAL, UNIT_1_25_MS),
+    .slave_latency = LINK_PROFILE_ACTIVE_LATENCY,
+    .conn_sup_timeout = MSEC_TO_UNITS(LINK_PROFILE_ACTIVE_TIMEOUT, UNIT_10_MS),
+   },
+   [LINK_PROFILE_IDLE] =
+   {
+    .min_conn_interval = MSEC_TO_UNITS(LINK_PROFILE_IDLE_MIN_INTERVAL, UNIT_1_25_MS),
+    .max_conn_interval = MSEC_TO_UNITS(LINK_PROFILE_IDLE_MAX_INTERVAL, UNIT_1_25_MS),
+    .slave_latency = LINK_PROFILE_IDLE_LATENCY,
+    .conn_sup_timeout = MSEC_TO_UNITS(LINK_PROFILE_IDLE_TIMEOUT, UNIT_10_MS),
+   },
+  };
+
+static link_t m_links[NRF_SDH_BLE_PERIPHERAL_LINK_COUNT];
+
+APP_TIMER_DEF(m_tick_timer_id);
+static bool m_tick_timer_running = false;
+
+static link_t *
+link_find(uint16_t conn_handle)
+{
+  for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+      if (m_links[i].conn_handle == conn_handle)
+        {
+          return &m_links[i];
+        }
+    }
+  return NULL;
+}
+
+// Returns the profile whose interval range contains the connection interval
+// chosen by the central.
+static link_profile_t
+link_profile_of(ble_gap_conn_params_t const *params)
+{
+  for (link_profile_t profile = LINK_PROFILE_ACTIVE; profile <= LINK_PROFILE_IDLE; profile++)
+    {
+      if (params->max_conn_interval >= m_profiles[profile].min_conn_interval &&
+          params->max_conn_interval <= m_profiles[profile].max_conn_interval)
+        {
+          return profile;
+        }
+    }
+  return LINK_PROFILE_NONE;
+}
+
+static void
+link_request(link_t *link, link_profile_t profile)
+{
+  if (link->requested == profile && link->request_ticks * LINK_PROFILE_TICK < LINK_PROFILE_RETRY_DELAY)
+    {
+      // Waiting for the central to apply the request.
+      return;
+    }
+
+  ble_gap_conn_params_t params = m_profiles[profile];
+
+  ret_code_t err_code = sd_ble_gap_conn_param_update(link->conn_handle, &params);
+  if (err_code == NRF_SUCCESS)
+    {
+      NRF_LOG_DEBUG("Requesting %s connection parameters.", profile == LINK_PROFILE_ACTIVE ? "active" : "idle");
+      link->requested = profile;
+      link->request_ticks = 0;
+    }
+  else if (err_code != NRF_ERROR_BUSY && err_code != NRF_ERROR_INVALID_STATE)
+    {
+      APP_ERROR_CHECK(err_code);
+    }
+  // Otherwise a procedure is still running; the next tick retries.
+}
+
+static void
+tick_timer_update()
+{
+  bool connected = false;
+  for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+      connected |= (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID);
+    }
+
+  ret_code_t err_code = NRF_SUCCESS;
+  if (connected && !m_tick_timer_running)
+    {
+      err_code = app_timer_start(m_tick_timer_id, APP_TIMER_TICKS(LINK_PROFILE_TICK), NULL);
+    }
+  else if (!connected && m_tick_timer_running)
+    {
+      err_code = app_timer_stop(m_tick_timer_id);
+    }
+  APP_ERROR_CHECK(err_code);
+
+  m_tick_timer_running = connected;
+}
+
+// Reclaims links that hold a connection without using it. Unencrypted links
+// get a fixed time from connecting, so a stray phone cannot block an admin
+// session by keeping the link busy. That time does not run while pairing,
+// which the SMP timeout bounds, so a user can take their time to enter the
+// passkey.
+static bool
+link_idle_expired(link_t *link)
+{
+  uint32_t timeout = LINK_IDLE_TIMEOUT;
+  uint32_t elapsed = link->idle_ticks * LINK_PROFILE_TICK;
+
+  if (!ble_conn_state_encrypted(link->conn_handle))
+    {
+      timeout = LINK_UNAUTHENTICATED_TIMEOUT;
+      elapsed = link->connected_ticks * LINK_PROFILE_TICK;
+    }
+
+  if (link->disconnecting || timeout == 0 || elapsed < timeout)
+    {
+      return link->disconnecting;
+    }
+
+  NRF_LOG_INFO("Disconnecting idle or unauthenticated link %d.", link->conn_handle);
+
+  ret_code_t err_code = sd_ble_gap_disconnect(link->conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+  if (err_code != NRF_ERROR_INVALID_STATE)
+    {
+      APP_ERROR_CHECK(err_code);
+    }
+  link->disconnecting = true;
+  return true;
+}
+
+static void
+on_tick_timer(void *context)
+{
+  for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+      link_t *link = &m_links[i];
+      if (link->conn_handle == BLE_CONN_HANDLE_INVALID)
+        {
+          continue;
+        }
+
+      link->idle_ticks++;
+      link->request_ticks++;
+      if (!link->pairing)
+        {
+          link->connected_ticks++;
+        }
+
+      if (link_idle_expired(link))
+        {
+          continue;
+        }
+
+      uint32_t idle = link->idle_ticks * LINK_PROFILE_TICK;
+
+      link_profile_t wanted = (idle >= LINK_PROFILE_IDLE_DELAY) ? LINK_PROFILE_IDLE : LINK_PROFILE_ACTIVE;
+      if (link->profile != wanted)
+        {
+          link_request(link, wanted);
+        }
+    }
+}
+
+static void
+on_connected(uint16_t conn_handle, ble_gap_conn_params_t const *params)
+{
+  link_t *link = link_find(BLE_CONN_HANDLE_INVALID);
+  if (link != NULL)
+    {
+      link->conn_handle = conn_handle;
+      link->profile = link_profile_of(params);
+      link->requested = LINK_PROFILE_NONE;
+      link->request_ticks = 0;
+      link->idle_ticks = 0;
+      link->connected_ticks = 0;
+      link->pairing = false;
+      link->disconnecting = false;
+    }
+  tick_timer_update();
+}
+
+static void
+on_disconnected(uint16_t conn_handle)
+{
+  link_t *link = link_find(conn_handle);
+  if (link != NULL)
+    {
+      link->conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+  tick_timer_update();
+}
+
+static void
+on_ble_event(ble_evt_t const *ble_evt, void *context)
+{
+  switch (ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_CONNECTED:
+      on_connected(ble_evt->evt.gap_evt.conn_handle, &ble_evt->evt.gap_evt.params.connected.conn_params);
+      break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+      on_disconnected(ble_evt->evt.gap_evt.conn_handle);
+      break;
+
+    case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+      {
+        ble_gap_conn_params_t const *params = &ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+        NRF_LOG_INFO("Connection interval %d units, latency %d.", params->max_conn_interval, params->slave_latency);
+
+        link_t *link = link_find(ble_evt->evt.gap_evt.conn_handle);
+        if (link != NULL)
+          {
+            link->profile = link_profile_of(params);
+            link->requested = LINK_PROFILE_NONE;
+          }
+      }
+      break;
+
+    case BLE_GAP_EVT_AUTH_STATUS:
+      {
+        link_t *link = link_find(ble_evt->evt.gap_evt.conn_handle);
+        if (link != NULL)
+          {
+            link->pairing = false;
+          }
+      }
+      break;
+
+    // Only traffic initiated by the peer counts as activity. Notifications
+    // sent by the beacon itself would otherwise keep the link fast.
+
+    case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+      {
+        link_t *link = link_find(ble_evt->evt.gap_evt.conn_handle);
+        if (link != NULL)
+          {
+            link->pairing = true;
+          }
+      }
+      link_profile_activity(ble_evt->evt.gap_evt.conn_handle);
+      break;
+
+    case BLE_GAP_EVT_CONN_SEC_UPDATE:
+    case BLE_GATTS_EVT_WRITE:
+    case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+    case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
+    case BLE_EVT_USER_MEM_REQUEST:
+      link_profile_activity(ble_evt->evt.common_evt.conn_handle);
+      break;
+
+    default:
+      break;
+    }
+}
+
+void
+link_profile_activity(uint16_t conn_handle)
+{
+  link_t *link = link_find(conn_handle);
+  if (link != NULL)
+    {
+      link->idle_ticks = 0;
+      if (link->profile != LINK_PROFILE_ACTIVE)
+        {
+          link_request(link, LINK_PROFILE_ACTIVE);
+        }
+    }
+}
+
+void
+link_profile_init()
+{
+  for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+      m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+
+  // Centrals that honour the PPCP start out fast; the others are asked on the
+  // first tick.
+  ble_gap_conn_params_t params = m_profiles[LINK_PROFILE_ACTIVE];
+  ret_code_t err_code = sd_ble_gap_ppcp_set(&params);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_tick_timer_id, APP_TIMER_MODE_REPEATED, on_tick_timer);
+  APP_ERROR_CHECK(err_code);
+
+  NRF_SDH_BLE_OBSERVER(m_ble_observer, 3, on_ble_event, NULL);
+}
@@ -24,6 +24,10 @@
 #include "button.h"
 #include "beacon.h"
 #include "beacon_config.h"
+#include "beacon_config_service.h"
+#include "energy.h"
+#include "lesc.h"
+#include "power.h"
 
 #include "config.h"
 
@@ -84,6 +88,16 @@ softdevice_init()
 
   err_code = nrf_sdh_ble_enable(&ram_start);
   APP_ERROR_CHECK(err_code);
+
+  // ram_start now holds the lowest application RAM address the SoftDevice
+  // configuration allows; see the RAM origin in the board linker scripts.
+  NRF_LOG_INFO("SoftDevice RAM: %d bytes, application RAM start 0x%08x", ram_start - 0x20000000, ram_start);
+}
+
+static void
+on_config_saved()
+{
+  beacon_config_service_status_notify(BEACON_STATUS_EVENT_CONFIG_SAVED);
 }
 
 static void
@@ -93,7 +107,7 @@ on_button_callback(button_event_t event, int duration)
     {
     case BUTTON_EVENT_PRESS:
       NRF_LOG_DEBUG("Button press\n");
-      if (duration == 2 && !beacon_is_connected())
+      if (duration == 2 && beacon_has_free_link())
         {
           indicator_start(flash_twice_fast_indicator);
           NRF_LOG_DEBUG("Release to become connectable\n");
@@ -114,6 +128,11 @@ on_button_callback(button_event_t event, int duration)
           NRF_LOG_DEBUG("Release to reset board\n");
         }
       else if (duration == 20)
+        {
+          indicator_start(flash_five_times_fast_indicator);
+          NRF_LOG_DEBUG("Release to enter shipping mode\n");
+        }
+      else if (duration == 25)
         {
           indicator_start(flash_once_indicator);
           NRF_LOG_DEBUG("Release cancel\n");
@@ -122,13 +141,17 @@ on_button_callback(button_event_t event, int duration)
 
     case BUTTON_EVENT_RELEASE:
       NRF_LOG_DEBUG("Button release\n");
-      if (duration >= 20)
+      if (duration >= 25)
         {
           // Ignore
         }
+      else if (duration >= 20)
+        {
+          power_ship();
+        }
       else if (duration >= 15)
         {
-          NVIC_SystemReset();
+          nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_RESET);
         }
       else if (duration >= 10)
         {
@@ -142,7 +165,7 @@ on_button_callback(button_event_t event, int duration)
           err_code = pm_peers_delete();
           APP_ERROR_CHECK(err_code);
         }
-      else if (duration >= 2 && duration < 5 && !beacon_is_connected())
+      else if (duration >= 2 && duration < 5 && beacon_has_free_link())
         {
           beacon_start_advertising_connectable();
         }
@@ -198,8 +221,10 @@ main()
   power_management_init();
   softdevice_init();
 
-  beacon_config_init();
+  beacon_config_init(on_config_saved);
+  energy_init();
   beacon_init();
+  power_init();
 
   beacon_start_advertising();
 
@@ -208,6 +233,7 @@ main()
   NRF_LOG_INFO("main loop...\n");
   for (;;)
     {
+      lesc_process();
       power_manage();
     }
 }
@@ -0,0 +1,262 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <stdint.h>
+
+#include "power.h"
+
+#include "battery_history.h"
+#include "beacon.h"
+#include "beacon_config.h"
+#include "button.h"
+#include "config.h"
+#include "energy.h"
+#include "indicator.h"
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+#include "nrf_sdh_soc.h"
+#include "nrf_soc.h"
+
+APP_TIMER_DEF(m_recovery_timer_id);
+APP_TIMER_DEF(m_ship_timer_id);
+
+static bool m_power_failing = false;
+static power_battery_state_t m_battery_state = POWER_BATTERY_NORMAL;
+static bool m_initialized = false;
+static bool m_shipping = false;
+static bool m_ship_disconnecting = false;
+
+static void
+on_recovery_timer(void *context)
+{
+  NRF_LOG_INFO("Resuming after power failure warning.");
+
+  m_power_failing = false;
+  beacon_start_advertising();
+}
+
+static void
+on_power_failure_warning()
+{
+  NRF_LOG_WARNING("Power failure warning.");
+
+  if (!m_power_failing)
+    {
+      m_power_failing = true;
+
+      // Free the radio and supply before brownout, then commit what is pending.
+      beacon_stop_advertising();
+      beacon_disconnect();
+      beacon_config_flush();
+      battery_history_flush();
+      energy_flush();
+    }
+
+  ret_code_t err_code = app_timer_stop(m_recovery_timer_id);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_start(m_recovery_timer_id, APP_TIMER_TICKS(POWER_FAIL_RECOVERY_DELAY), NULL);
+  APP_ERROR_CHECK(err_code);
+}
+
+static void
+on_soc_event(uint32_t evt_id, void *context)
+{
+  switch (evt_id)
+    {
+    case NRF_EVT_POWER_FAILURE_WARNING:
+      on_power_failure_warning();
+      break;
+
+    default:
+      break;
+    }
+}
+
+static bool
+power_shutdown_handler(nrf_pwr_mgmt_evt_t event)
+{
+  if (event == NRF_PWR_MGMT_EVT_PREPARE_SYSOFF)
+    {
+      // The LED keeps its state in System OFF.
+      indicator_stop();
+      button_wakeup_enable();
+    }
+  return true;
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(power_shutdown_handler, 1);
+
+static power_battery_state_t
+battery_state_for(uint16_t voltage)
+{
+  // Leaving a state takes a voltage that is BATTERY_STATE_HYSTERESIS higher
+  // than the one that entered it.
+  uint16_t critical = BATTERY_CRITICAL_VOLTAGE;
+  uint16_t low = BATTERY_LOW_VOLTAGE;
+
+  if (m_battery_state == POWER_BATTERY_CRITICAL)
+    {
+      critical += BATTERY_STATE_HYSTERESIS;
+    }
+  if (m_battery_state != POWER_BATTERY_NORMAL)
+    {
+      low += BATTERY_STATE_HYSTERESIS;
+    }
+
+  if (voltage <= critical)
+    {
+      return POWER_BATTERY_CRITICAL;
+    }
+  if (voltage <= low)
+    {
+      return POWER_BATTERY_LOW;
+    }
+  return POWER_BATTERY_NORMAL;
+}
+
+void
+power_battery_update(uint16_t voltage)
+{
+  if (voltage <= BATTERY_OFF_VOLTAGE)
+    {
+      NRF_LOG_WARNING("Battery empty (%d mV).", voltage);
+
+      // The shutdown handlers must not write flash on an empty cell.
+      m_battery_state = POWER_BATTERY_CRITICAL;
+      power_off();
+      return;
+    }
+
+  power_battery_state_t state = battery_state_for(voltage);
+  if (state == m_battery_state)
+    {
+      return;
+    }
+
+  NRF_LOG_INFO("Battery state %d -> %d (%d mV).", m_battery_state, state, voltage);
+  power_battery_state_t previous = m_battery_state;
+  m_battery_state = state;
+
+  if (state != POWER_BATTERY_CRITICAL)
+    {
+      // Save while the battery can still supply the flash writes, or when it
+      // recovered from a critical state.
+      beacon_config_flush();
+      battery_history_flush();
+      energy_flush();
+    }
+
+  if (m_initialized && (state == POWER_BATTERY_CRITICAL || previous == POWER_BATTERY_CRITICAL))
+    {
+      // Apply the advertising power and interval for the new state. During
+      // boot, advertising starts with them.
+      beacon_start_advertising();
+    }
+}
+
+power_battery_state_t
+power_battery_state()
+{
+  return m_battery_state;
+}
+
+bool
+power_flash_allowed()
+{
+  return m_battery_state != POWER_BATTERY_CRITICAL;
+}
+
+void
+power_off()
+{
+  NRF_LOG_INFO("Entering System OFF.");
+  nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_GOTO_SYSOFF);
+}
+
+static void
+on_ship_timer(void *context)
+{
+  // The control point reply has been sent by now. Disconnect, and give the
+  // links another delay to go down before powering off.
+  if (beacon_is_connected() && !m_ship_disconnecting)
+    {
+      m_ship_disconnecting = true;
+      beacon_disconnect();
+
+      ret_code_t err_code = app_timer_start(m_ship_timer_id, APP_TIMER_TICKS(POWER_SHIP_DELAY), NULL);
+      APP_ERROR_CHECK(err_code);
+      return;
+    }
+
+  power_off();
+}
+
+void
+power_ship()
+{
+  if (m_shipping)
+    {
+      return;
+    }
+
+  NRF_LOG_INFO("Entering shipping mode.");
+
+  m_shipping = true;
+  beacon_stop_advertising();
+
+  ret_code_t err_code = app_timer_start(m_ship_timer_id, APP_TIMER_TICKS(POWER_SHIP_DELAY), NULL);
+  APP_ERROR_CHECK(err_code);
+}
+
+bool
+power_is_shipping()
+{
+  return m_shipping;
+}
+
+void
+power_init()
+{
+  ret_code_t err_code = app_timer_create(&m_recovery_timer_id, APP_TIMER_MODE_SINGLE_SHOT, on_recovery_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_ship_timer_id, APP_TIMER_MODE_SINGLE_SHOT, on_ship_timer);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = sd_power_pof_threshold_set(POWER_FAIL_THRESHOLD);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = sd_power_pof_enable(true);
+  APP_ERROR_CHECK(err_code);
+
+  NRF_SDH_SOC_OBSERVER(m_soc_observer, 1, on_soc_event, NULL);
+
+  m_initialized = true;
+}
+
+bool
+power_is_failing()
+{
+  return m_power_failing;
+}
@@ -0,0 +1,56 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Minimal checks for the host tests. Each test program returns the number of
+// failed checks.
+
+static int test_failures = 0;
+
+#define CHECK(expr)                                                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(expr))                                                      \
+        {                                                               \
+          fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+          test_failures++;                                              \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+#define CHECK_EQ(actual, expected)                                      \
+  do                                                                    \
+    {                                                                   \
+      long long a_ = (actual);                                          \
+      long long e_ = (expected);                                        \
+      if (a_ != e_)                                                     \
+        {                                                               \
+          fprintf(stderr, "%s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); \
+          test_failures++;                                              \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+#endif // TEST_H
@@ -0,0 +1,102 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "battery_convert.h"
+
+#include "test.h"
+
+// The datasheet formula: V = raw * reference * scaling / 2^resolution.
+static long
+expected_voltage(int32_t raw, double reference, double scaling, int resolution)
+{
+  if (raw < 0)
+    {
+      raw = 0;
+    }
+  return lround(floor(raw * reference * scaling / (1 << resolution) + 0.5)) + BATTERY_DIODE_DROP;
+}
+
+static void
+test_saadc_formula()
+{
+  for (int32_t raw = 0; raw < (1 << BATTERY_SAADC_RESOLUTION_BITS); raw++)
+    {
+      CHECK_EQ(battery_saadc_convert(raw), expected_voltage(raw, 600, 6, 12));
+    }
+}
+
+static void
+test_adc_formula()
+{
+  for (int32_t raw = 0; raw < (1 << BATTERY_ADC_RESOLUTION_BITS); raw++)
+    {
+      CHECK_EQ(battery_adc_convert(raw), expected_voltage(raw, 1200, 3, 10));
+    }
+}
+
+static void
+test_known_values()
+{
+  // Full scale is 3.6 V for both backends.
+  CHECK_EQ(battery_saadc_convert(4095), 3599 + BATTERY_DIODE_DROP);
+  CHECK_EQ(battery_adc_convert(1023), 3596 + BATTERY_DIODE_DROP);
+
+  // 3.0 V supply.
+  CHECK_EQ(battery_saadc_convert(3413), 3000 + BATTERY_DIODE_DROP);
+  CHECK_EQ(battery_adc_convert(853), 2999 + BATTERY_DIODE_DROP);
+}
+
+static void
+test_negative_raw()
+{
+  // The SAADC reports small negative values for inputs near ground.
+  CHECK_EQ(battery_saadc_convert(-1), BATTERY_DIODE_DROP);
+  CHECK_EQ(battery_saadc_convert(-2048), BATTERY_DIODE_DROP);
+  CHECK_EQ(battery_adc_convert(0), BATTERY_DIODE_DROP);
+}
+
+static void
+test_backends_agree()
+{
+  // Both backends measure the same supply to within one ADC step.
+  for (int32_t adc_raw = 0; adc_raw < (1 << BATTERY_ADC_RESOLUTION_BITS); adc_raw++)
+    {
+      int32_t saadc_raw = adc_raw * 4;
+      long delta = (long) battery_saadc_convert(saadc_raw) - battery_adc_convert(adc_raw);
+      CHECK(labs(delta) <= 4);
+    }
+}
+
+int
+main()
+{
+  test_saadc_formula();
+  test_adc_formula();
+  test_known_values();
+  test_negative_raw();
+  test_backends_agree();
+
+  return test_failures;
+}
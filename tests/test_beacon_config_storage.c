@@ -0,0 +1,195 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "beacon_config_storage.h"
+
+#include "test.h"
+
+// Copy of the version 3 layout as written by older firmware.
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  struct
+  {
+    uint8_t interval;
+    uint8_t remain_connectable;
+    uint16_t adv_interval;
+    uint8_t power;
+    uint8_t pin[7];
+    uint8_t irk[BLE_GAP_SEC_KEY_LEN];
+  } config;
+} storage_v3_t;
+
+static const uint8_t IRK[BLE_GAP_SEC_KEY_LEN] =
+  { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10 };
+
+static storage_v3_t
+make_v3()
+{
+  storage_v3_t v3;
+  memset(&v3, 0, sizeof(v3));
+  v3.magic = BEACON_CONFIG_MAGIC;
+  v3.version = 3;
+  v3.config.interval = 15;
+  v3.config.remain_connectable = 1;
+  v3.config.adv_interval = 350;
+  v3.config.power = (uint8_t) -4;
+  memcpy(v3.config.pin, "654321", 7);
+  memcpy(v3.config.irk, IRK, sizeof(IRK));
+  return v3;
+}
+
+static beacon_config_storage_t
+make_v4()
+{
+  beacon_config_storage_t v4;
+  memset(&v4, 0, sizeof(v4));
+  v4.magic = BEACON_CONFIG_MAGIC;
+  v4.version = 4;
+  v4.config.rotation = 600;
+  v4.config.adv_interval = 1000;
+  v4.config.remain_connectable = 0;
+  v4.config.power = -8;
+  memcpy(v4.config.pin, "123456", 7);
+  memcpy(v4.config.irk, IRK, sizeof(IRK));
+  return v4;
+}
+
+// Records are stored in whole words.
+static uint32_t
+stored_size(size_t size)
+{
+  return (size + 3) & ~3u;
+}
+
+static void
+test_current_version()
+{
+  beacon_config_storage_t v4 = make_v4();
+  beacon_config_storage_t storage;
+
+  CHECK_EQ(beacon_config_storage_load(&storage, &v4, stored_size(sizeof(v4))), BEACON_CONFIG_STORAGE_CURRENT);
+  CHECK(memcmp(&storage, &v4, sizeof(v4)) == 0);
+}
+
+static void
+test_upgrade_v3()
+{
+  storage_v3_t v3 = make_v3();
+  uint8_t record[64] = { 0 };
+  memcpy(record, &v3, sizeof(v3));
+
+  beacon_config_storage_t storage;
+  CHECK_EQ(beacon_config_storage_load(&storage, record, stored_size(sizeof(v3))), BEACON_CONFIG_STORAGE_UPGRADED);
+  CHECK_EQ(storage.magic, BEACON_CONFIG_MAGIC);
+  CHECK_EQ(storage.version, BEACON_CONFIG_VERSION);
+  CHECK_EQ(storage.config.rotation, 15 * 60);
+  CHECK_EQ(storage.config.remain_connectable, 1);
+  CHECK_EQ(storage.config.adv_interval, 350);
+  CHECK_EQ(storage.config.power, -4);
+  CHECK(memcmp(storage.config.pin, "654321", 7) == 0);
+  CHECK(memcmp(storage.config.irk, IRK, sizeof(IRK)) == 0);
+}
+
+static void
+test_upgrade_v3_max_interval()
+{
+  storage_v3_t v3 = make_v3();
+  v3.config.interval = 255;
+
+  beacon_config_storage_t storage;
+  CHECK_EQ(beacon_config_storage_load(&storage, &v3, sizeof(v3)), BEACON_CONFIG_STORAGE_UPGRADED);
+  CHECK_EQ(storage.config.rotation, 255 * 60);
+}
+
+static void
+test_truncated_records()
+{
+  storage_v3_t v3 = make_v3();
+  beacon_config_storage_t v4 = make_v4();
+  beacon_config_storage_t storage;
+
+  CHECK_EQ(beacon_config_storage_load(&storage, &v3, sizeof(v3) - 1), BEACON_CONFIG_STORAGE_INVALID);
+  CHECK_EQ(beacon_config_storage_load(&storage, &v4, sizeof(v4) - 1), BEACON_CONFIG_STORAGE_INVALID);
+  CHECK_EQ(beacon_config_storage_load(&storage, &v4, offsetof(beacon_config_storage_t, config) - 1), BEACON_CONFIG_STORAGE_INVALID);
+  CHECK_EQ(beacon_config_storage_load(&storage, &v4, 0), BEACON_CONFIG_STORAGE_INVALID);
+}
+
+static void
+test_longer_record()
+{
+  // A record written by newer firmware with the same version but extra
+  // trailing data is accepted.
+  beacon_config_storage_t v4 = make_v4();
+  uint8_t record[sizeof(v4) + 16];
+  memset(record, 0xff, sizeof(record));
+  memcpy(record, &v4, sizeof(v4));
+
+  beacon_config_storage_t storage;
+  CHECK_EQ(beacon_config_storage_load(&storage, record, sizeof(record)), BEACON_CONFIG_STORAGE_CURRENT);
+  CHECK(memcmp(&storage, &v4, sizeof(v4)) == 0);
+}
+
+static void
+test_unknown_versions()
+{
+  beacon_config_storage_t storage;
+  beacon_config_storage_t record = make_v4();
+
+  uint16_t versions[] = { 0, 1, 2, BEACON_CONFIG_VERSION + 1, 0xffff };
+  for (size_t i = 0; i < sizeof(versions) / sizeof(versions[0]); i++)
+    {
+      record.version = versions[i];
+      CHECK_EQ(beacon_config_storage_load(&storage, &record, sizeof(record)), BEACON_CONFIG_STORAGE_INVALID);
+    }
+}
+
+static void
+test_bad_magic()
+{
+  beacon_config_storage_t v4 = make_v4();
+  storage_v3_t v3 = make_v3();
+  beacon_config_storage_t storage;
+
+  v4.magic ^= 1;
+  v3.magic = 0xffffffff;
+  CHECK_EQ(beacon_config_storage_load(&storage, &v4, sizeof(v4)), BEACON_CONFIG_STORAGE_INVALID);
+  CHECK_EQ(beacon_config_storage_load(&storage, &v3, sizeof(v3)), BEACON_CONFIG_STORAGE_INVALID);
+}
+
+int
+main()
+{
+  test_current_version();
+  test_upgrade_v3();
+  test_upgrade_v3_max_interval();
+  test_truncated_records();
+  test_longer_record();
+  test_unknown_versions();
+  test_bad_magic();
+
+  return test_failures;
+}
@@ -0,0 +1,184 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "beacon_config_tlv.h"
+
+#include "test.h"
+
+// Version byte plus a tag/length header and value per field.
+#define ENCODED_SIZE (1 + (2 + 2) + (2 + 1) + (2 + 2) + (2 + 1) + (2 + 6) + (2 + BLE_GAP_SEC_KEY_LEN))
+
+static beacon_config_t
+make_config()
+{
+  beacon_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.rotation = 900;
+  config.adv_interval = 1000;
+  config.remain_connectable = 1;
+  config.power = -8;
+  memcpy(config.pin, "123456", 7);
+  for (int i = 0; i < BLE_GAP_SEC_KEY_LEN; i++)
+    {
+      config.irk[i] = i + 1;
+    }
+  return config;
+}
+
+static void
+test_round_trip()
+{
+  beacon_config_t config = make_config();
+  uint8_t data[BEACON_CONFIG_TLV_MAX_SIZE];
+
+  uint16_t len = beacon_config_encode(&config, data, sizeof(data));
+  CHECK_EQ(len, ENCODED_SIZE);
+  CHECK_EQ(data[0], BEACON_CONFIG_TLV_VERSION);
+
+  beacon_config_t decoded;
+  memset(&decoded, 0, sizeof(decoded));
+  CHECK(beacon_config_decode(&decoded, data, len));
+  CHECK(memcmp(&decoded, &config, sizeof(config)) == 0);
+}
+
+static void
+test_encode_too_small()
+{
+  beacon_config_t config = make_config();
+  uint8_t data[BEACON_CONFIG_TLV_MAX_SIZE];
+
+  CHECK_EQ(beacon_config_encode(&config, data, ENCODED_SIZE - 1), 0);
+  CHECK_EQ(beacon_config_encode(&config, data, 0), 0);
+}
+
+static void
+test_truncated_entries()
+{
+  beacon_config_t config = make_config();
+  beacon_config_t decoded;
+
+  // Only a tag, without its length.
+  uint8_t tag_only[] = { BEACON_CONFIG_TLV_VERSION, BEACON_CONFIG_TAG_POWER };
+  CHECK(!beacon_config_decode(&decoded, tag_only, sizeof(tag_only)));
+
+  // A value shorter than its length.
+  uint8_t short_value[] = { BEACON_CONFIG_TLV_VERSION, BEACON_CONFIG_TAG_ADV_INTERVAL, 2, 0x64 };
+  CHECK(!beacon_config_decode(&decoded, short_value, sizeof(short_value)));
+
+  // Every truncation of a complete encoding that ends inside an entry.
+  uint8_t data[BEACON_CONFIG_TLV_MAX_SIZE];
+  uint16_t len = beacon_config_encode(&config, data, sizeof(data));
+  uint16_t entry = 1;
+  for (uint16_t cut = 2; cut < len; cut++)
+    {
+      bool boundary = (cut == entry + 2 + data[entry + 1]);
+      if (boundary)
+        {
+          entry = cut;
+        }
+      CHECK_EQ(beacon_config_decode(&decoded, data, cut), boundary);
+    }
+}
+
+static void
+test_length_mismatch()
+{
+  beacon_config_t decoded = make_config();
+
+  // Power is one byte.
+  uint8_t power[] = { BEACON_CONFIG_TLV_VERSION, BEACON_CONFIG_TAG_POWER, 2, 0xfc, 0xff };
+  CHECK(!beacon_config_decode(&decoded, power, sizeof(power)));
+
+  // The PIN is six digits.
+  uint8_t pin[] = { BEACON_CONFIG_TLV_VERSION, BEACON_CONFIG_TAG_PIN, 5, '1', '2', '3', '4', '5' };
+  CHECK(!beacon_config_decode(&decoded, pin, sizeof(pin)));
+
+  uint8_t irk[] = { BEACON_CONFIG_TLV_VERSION, BEACON_CONFIG_TAG_IRK, 0 };
+  CHECK(!beacon_config_decode(&decoded, irk, sizeof(irk)));
+}
+
+static void
+test_unknown_tags_skipped()
+{
+  beacon_config_t config = make_config();
+  beacon_config_t decoded = config;
+
+  uint8_t data[] =
+    {
+      BEACON_CONFIG_TLV_VERSION,
+      0x7f, 3, 0xaa, 0xbb, 0xcc,
+      BEACON_CONFIG_TAG_ADV_INTERVAL, 2, 0xf4, 0x01,
+      0x80, 0,
+      BEACON_CONFIG_TAG_POWER, 1, 0x00,
+    };
+  CHECK(beacon_config_decode(&decoded, data, sizeof(data)));
+
+  config.adv_interval = 500;
+  config.power = 0;
+  CHECK(memcmp(&decoded, &config, sizeof(config)) == 0);
+}
+
+static void
+test_wrong_version()
+{
+  beacon_config_t config = make_config();
+  beacon_config_t decoded = config;
+  uint8_t data[BEACON_CONFIG_TLV_MAX_SIZE];
+
+  uint16_t len = beacon_config_encode(&config, data, sizeof(data));
+
+  data[0] = 1;
+  CHECK(!beacon_config_decode(&decoded, data, len));
+  data[0] = BEACON_CONFIG_TLV_VERSION + 1;
+  CHECK(!beacon_config_decode(&decoded, data, len));
+  CHECK(memcmp(&decoded, &config, sizeof(config)) == 0);
+}
+
+static void
+test_empty_payload()
+{
+  beacon_config_t config = make_config();
+  beacon_config_t decoded = config;
+  uint8_t data[] = { BEACON_CONFIG_TLV_VERSION };
+
+  CHECK(!beacon_config_decode(&decoded, data, 0));
+
+  // A version byte without entries changes nothing.
+  CHECK(beacon_config_decode(&decoded, data, sizeof(data)));
+  CHECK(memcmp(&decoded, &config, sizeof(config)) == 0);
+}
+
+int
+main()
+{
+  test_round_trip();
+  test_encode_too_small();
+  test_truncated_entries();
+  test_length_mismatch();
+  test_unknown_tags_skipped();
+  test_wrong_version();
+  test_empty_payload();
+
+  return test_failures;
+}
@@ -0,0 +1,155 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "beacon_config.h"
+
+#include "test.h"
+
+static beacon_config_t
+make_config()
+{
+  beacon_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.rotation = 900;
+  config.adv_interval = 350;
+  config.remain_connectable = 0;
+  config.power = 4;
+  memcpy(config.pin, "123456", 7);
+  return config;
+}
+
+static void
+test_valid()
+{
+  beacon_config_t config = make_config();
+  CHECK_EQ(beacon_config_validate(&config), 0);
+
+  config.rotation = 0;
+  config.remain_connectable = 1;
+  config.adv_interval = BEACON_CONFIG_ADV_INTERVAL_MIN;
+  config.power = -40;
+  memcpy(config.pin, "000000", 7);
+  CHECK_EQ(beacon_config_validate(&config), 0);
+
+  config.rotation = BEACON_CONFIG_ROTATION_MAX;
+  config.adv_interval = BEACON_CONFIG_ADV_INTERVAL_MAX;
+  config.power = 3;
+  memcpy(config.pin, "999999", 7);
+  CHECK_EQ(beacon_config_validate(&config), 0);
+}
+
+static void
+test_rotation()
+{
+  beacon_config_t config = make_config();
+
+  config.rotation = BEACON_CONFIG_ROTATION_MAX + 1;
+  CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_ROTATION));
+}
+
+static void
+test_adv_interval()
+{
+  beacon_config_t config = make_config();
+
+  uint16_t invalid[] = { 0, BEACON_CONFIG_ADV_INTERVAL_MIN - 1, BEACON_CONFIG_ADV_INTERVAL_MAX + 1, 0xffff };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+      config.adv_interval = invalid[i];
+      CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_ADV_INTERVAL));
+    }
+}
+
+static void
+test_power()
+{
+  beacon_config_t config = make_config();
+
+  int8_t valid[] = { -40, -20, -16, -12, -8, -4, 0, 3, 4 };
+  for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+      config.power = valid[i];
+      CHECK_EQ(beacon_config_validate(&config), 0);
+    }
+
+  int8_t invalid[] = { -128, -41, -30, -10, -1, 1, 2, 5, 127 };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+      config.power = invalid[i];
+      CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_POWER));
+    }
+}
+
+static void
+test_pin()
+{
+  beacon_config_t config = make_config();
+
+  const char *invalid[] = { "12345a", "/23456", "12:456", "      ", "12345" };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+      memset(config.pin, 0, sizeof(config.pin));
+      memcpy(config.pin, invalid[i], strlen(invalid[i]));
+      CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_PIN));
+    }
+}
+
+static void
+test_remain_connectable()
+{
+  beacon_config_t config = make_config();
+
+  config.remain_connectable = 2;
+  CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_REMAIN_CONNECTABLE));
+  config.remain_connectable = 0xff;
+  CHECK_EQ(beacon_config_validate(&config), BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_REMAIN_CONNECTABLE));
+}
+
+static void
+test_multiple()
+{
+  beacon_config_t config = make_config();
+
+  config.adv_interval = 0;
+  config.power = 1;
+  config.pin[0] = 'x';
+  CHECK_EQ(beacon_config_validate(&config),
+           BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_ADV_INTERVAL) |
+           BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_POWER) |
+           BEACON_CONFIG_FIELD_BIT(BEACON_CONFIG_TAG_PIN));
+}
+
+int
+main()
+{
+  test_valid();
+  test_rotation();
+  test_adv_interval();
+  test_power();
+  test_pin();
+  test_remain_connectable();
+  test_multiple();
+
+  return test_failures;
+}
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""Generate per-device UICR hex patches with a random PIN and IRK.
+
+The layout must match factory_record_t in application/beacon_config.c.
+"""
+
+import argparse
+import binascii
+import csv
+import os
+import secrets
+import struct
+
+UICR_CUSTOMER_ADDRESS = 0x10001080
+FACTORY_MAGIC = 0x56505242
+
+
+def factory_record(pin, irk):
+    data = struct.pack('<I8s16sH', FACTORY_MAGIC, pin.encode('ascii'), irk, 0)
+    crc = binascii.crc_hqx(data, 0xFFFF)
+    return data + struct.pack('<H', crc)
+
+
+def ihex_line(address, record_type, data):
+    line = bytes([len(data), (address >> 8) & 0xFF, address & 0xFF, record_type]) + data
+    checksum = (-sum(line)) & 0xFF
+    return ':' + (line + bytes([checksum])).hex().upper() + '\n'
+
+
+def write_hex(filename, address, data):
+    with open(filename, 'w') as f:
+        f.write(ihex_line(0, 0x04, struct.pack('>H', address >> 16)))
+        for offset in range(0, len(data), 16):
+            f.write(ihex_line((address + offset) & 0xFFFF, 0x00, data[offset:offset + 16]))
+        f.write(ihex_line(0, 0x01, b''))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--count', type=int, required=True, help='number of devices')
+    parser.add_argument('--first', type=int, default=1, help='serial number of the first device')
+    parser.add_argument('--out', default='provision', help='output directory')
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+
+    with open(os.path.join(args.out, 'keys.csv'), 'w', newline='') as f:
+        keys = csv.writer(f)
+        keys.writerow(['serial', 'pin', 'irk'])
+
+        for serial in range(args.first, args.first + args.count):
+            pin = '%06d' % secrets.randbelow(1000000)
+            irk = secrets.token_bytes(16)
+
+            write_hex(os.path.join(args.out, 'uicr_%05d.hex' % serial), UICR_CUSTOMER_ADDRESS, factory_record(pin, irk))
+            keys.writerow([serial, pin, irk.hex()])
+
+
+if __name__ == '__main__':
+    main()